@@ -0,0 +1,99 @@
+/*
+ * This program measures the cost of SD CRC checking.
+ *
+ * A contiguous file is written and read with multiple block
+ * commands so card latency is spread over many blocks.  Time and
+ * CPU cycles per block are printed for the USE_SD_CRC setting in
+ * SdFatConfig.h.  Run it once for each setting and compare.
+ *
+ * Warning: the test file is overwritten.
+ */
+#include <SPI.h>
+#include <SdFat.h>
+
+// SD chip select pin
+const uint8_t chipSelect = SS;
+
+// number of blocks in the test file
+const uint32_t BLOCK_COUNT = 2000UL;
+
+// file system
+SdFat sd;
+
+// test file
+SdFile file;
+
+// Serial output stream
+ArduinoOutStream cout(Serial);
+//------------------------------------------------------------------------------
+// store error strings in flash to save RAM
+#define error(s) sd.errorHalt(F(s))
+//------------------------------------------------------------------------------
+void printTime(const __FlashStringHelper* op, uint32_t t) {
+  cout << op << t/BLOCK_COUNT << F(" micros, ");
+  cout << (t/BLOCK_COUNT)*(F_CPU/1000000UL) << F(" cycles per block\n");
+}
+//------------------------------------------------------------------------------
+void setup(void) {
+  Serial.begin(9600);
+  while (!Serial) {}  // wait for Leonardo
+}
+//------------------------------------------------------------------------------
+void loop(void) {
+  uint32_t bgnBlock, endBlock;
+  uint32_t t;
+
+  while (Serial.read() >= 0) {}
+  cout << F("Type any character to start\n");
+  while (Serial.read() <= 0) {}
+  delay(400);  // catch Due reset problem
+
+  if (!sd.begin(chipSelect, SPI_FULL_SPEED)) {
+    sd.initErrorHalt();
+  }
+  cout << F("USE_SD_CRC: ") << USE_SD_CRC << endl;
+
+  sd.remove("CrcBench.bin");
+  if (!file.createContiguous(sd.vwd(), "CrcBench.bin", 512UL*BLOCK_COUNT)) {
+    error("createContiguous failed");
+  }
+  if (!file.contiguousRange(&bgnBlock, &endBlock)) {
+    error("contiguousRange failed");
+  }
+  // NO SdFile calls are allowed while the cache is used as a buffer.
+  uint8_t* pCache = (uint8_t*)sd.vol()->cacheClear();
+  for (uint16_t i = 0; i < 512; i++) {
+    pCache[i] = i;
+  }
+
+  t = micros();
+  if (!sd.card()->writeStart(bgnBlock, BLOCK_COUNT)) {
+    error("writeStart failed");
+  }
+  for (uint32_t b = 0; b < BLOCK_COUNT; b++) {
+    if (!sd.card()->writeData(pCache)) {
+      error("writeData failed");
+    }
+  }
+  if (!sd.card()->writeStop()) {
+    error("writeStop failed");
+  }
+  printTime(F("Write: "), micros() - t);
+
+  t = micros();
+  if (!sd.card()->readStart(bgnBlock)) {
+    error("readStart failed");
+  }
+  for (uint32_t b = 0; b < BLOCK_COUNT; b++) {
+    if (!sd.card()->readData(pCache)) {
+      error("readData failed");
+    }
+  }
+  if (!sd.card()->readStop()) {
+    error("readStop failed");
+  }
+  printTime(F("Read: "), micros() - t);
+
+  file.close();
+  cout << F("Done\n\n");
+}
@@ -60,12 +60,27 @@ class SdVolume : public FatVolume {
   bool writeBlock(uint32_t block, const uint8_t* src) {
     return m_sdCard->writeBlock(block, src);
   }
+  bool syncBlocks() {
+    return m_sdCard->syncBlocks();
+  }
+  bool eraseBlocks(uint32_t firstBlock, uint32_t lastBlock) {
+    return m_sdCard->erase(firstBlock, lastBlock);
+  }
   bool readBlocks(uint32_t block, uint8_t* dst, size_t n) {
     return m_sdCard->readBlocks(block, dst, n);
   }
   bool writeBlocks(uint32_t block, const uint8_t* src, size_t n) {
     return m_sdCard->writeBlocks(block, src, n);
   }
+  bool readStart(uint32_t block) {
+    return m_sdCard->readStart(block);
+  }
+  bool readData(uint8_t* dst) {
+    return m_sdCard->readData(dst);
+  }
+  bool readStop() {
+    return m_sdCard->readStop();
+  }
   Sd2Card* m_sdCard;             // Sd2Card object for cache
 };
 #endif  // SdVolume_h
@@ -28,6 +28,15 @@ void (*FatFile::m_dateTime)(uint16_t* date, uint16_t* time) = 0;
 // Add a cluster to a file.
 bool FatFile::addCluster() {
   m_flags |= F_FILE_DIR_DIRTY;
+#if ENABLE_EXFAT
+  if (m_vol->isExFat()) {
+    return exFatAddCluster();
+  }
+#endif  // ENABLE_EXFAT
+  if (isFile() && m_extentClusters > 1) {
+    m_flags |= F_FILE_EXTENT;
+    return m_vol->allocExtent(m_curCluster, m_extentClusters, &m_curCluster);
+  }
   return m_vol->allocateCluster(m_curCluster, &m_curCluster);
 }
 //------------------------------------------------------------------------------
@@ -58,7 +67,7 @@ bool FatFile::addDirCluster() {
   }
   memset(pc, 0, 512);
   // zero rest of clusters
-  for (uint8_t i = 1; i < m_vol->blocksPerCluster(); i++) {
+  for (uint16_t i = 1; i < m_vol->blocksPerCluster(); i++) {
     if (!m_vol->writeBlock(block + i, pc->data)) {
       DBG_FAIL_MACRO;
       goto fail;
@@ -66,6 +75,12 @@ bool FatFile::addDirCluster() {
   }
   // Set position to EOF to avoid inconsistent curCluster/curPosition.
   m_curPosition += 512UL*m_vol->blocksPerCluster();
+#if ENABLE_EXFAT
+  if (m_vol->isExFat()) {
+    // An exFAT directory has a size, sync() writes it to the parent.
+    m_fileSize = m_curPosition;
+  }
+#endif  // ENABLE_EXFAT
   return true;
 
 fail:
@@ -88,7 +103,9 @@ fail:
 }
 //------------------------------------------------------------------------------
 bool FatFile::close() {
-  bool rtn = sync();
+  // free clusters reserved past end of file
+  bool rtn = !(m_flags & F_FILE_EXTENT) || truncate(m_fileSize);
+  rtn = sync() && rtn;
   m_attr = FILE_ATTR_CLOSED;
   return rtn;
 }
@@ -99,6 +116,15 @@ bool FatFile::contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock) {
     DBG_FAIL_MACRO;
     goto fail;
   }
+#if ENABLE_EXFAT
+  if ((m_flags & F_NO_FAT_CHAIN) && m_fileSize) {
+    uint32_t last = m_firstCluster
+                    + ((m_fileSize - 1) >> (m_vol->clusterSizeShift() + 9));
+    *bgnBlock = m_vol->clusterStartBlock(m_firstCluster);
+    *endBlock = m_vol->clusterStartBlock(last) + m_vol->blocksPerCluster() - 1;
+    return true;
+  }
+#endif  // ENABLE_EXFAT
   for (uint32_t c = m_firstCluster; ; c++) {
     uint32_t next;
     int8_t fg = m_vol->fatGet(c, &next);
@@ -132,6 +158,13 @@ bool FatFile::createContiguous(FatFile* dirFile,
     DBG_FAIL_MACRO;
     goto fail;
   }
+#if ENABLE_EXFAT
+  // exFAT files are allocated contiguous as they grow.
+  if (dirFile->m_vol->isExFat()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+#endif  // ENABLE_EXFAT
   if (!open(dirFile, path, O_CREAT | O_EXCL | O_RDWR)) {
     DBG_FAIL_MACRO;
     goto fail;
@@ -152,6 +185,101 @@ bool FatFile::createContiguous(FatFile* dirFile,
 
   return sync();
 
+fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+bool FatFile::createAt(FatFile* dirFile, const char* name, uint16_t index,
+                       uint8_t oflag) {
+  fname_t fname;
+  dir_t* dir;
+  bool skipReadOk = false;
+
+  // error if already open
+  if (isOpen() || !dirFile->isDir()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  if (!parsePathName(name, &fname, &name) || *name) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  oflag |= O_CREAT | O_EXCL;
+#if ENABLE_EXFAT
+  if (dirFile->m_vol->isExFat()) {
+    return open(dirFile, &fname, oflag);
+  }
+#endif  // ENABLE_EXFAT
+#if USE_LONG_FILE_NAMES
+  if (fname.flags & FNAME_FLAG_NEED_LFN) {
+    return open(dirFile, &fname, oflag);
+  }
+#endif  // USE_LONG_FILE_NAMES
+  if (!(oflag & O_WRITE) || !dirFile->seekSet(32UL*index)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  // first free entry at or after index
+  while (1) {
+    dir = dirFile->readDirCache(skipReadOk);
+    if (!dir) {
+      if (dirFile->getError()) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      // At EOF, will fail if FAT16 root.
+      if (!dirFile->addDirCluster()) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      break;
+    }
+    if (dir->name[0] == DIR_NAME_DELETED || dir->name[0] == DIR_NAME_FREE) {
+      break;
+    }
+    skipReadOk = true;
+    index++;
+  }
+  if (!dirFile->seekSet(32UL*index)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  dir = dirFile->readDirCache();
+  if (!dir) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  // initialize as empty file
+  memset(dir, 0, sizeof(dir_t));
+  memcpy(dir->name, fname.sfn, 11);
+#if DIR_INDEX_SIZE
+  if (dirFile->m_vol->m_dirIndexCluster == dirFile->m_firstCluster) {
+    dirFile->m_vol->dirIndexPut(index, dirIndexValue(dir));
+  }
+#endif  // DIR_INDEX_SIZE
+
+  // Set base-name and extension lower case bits.
+  dir->reservedNT =  (DIR_NT_LC_BASE | DIR_NT_LC_EXT) & fname.flags;
+
+  // set timestamps
+  if (m_dateTime) {
+    // call user date/time function
+    m_dateTime(&dir->creationDate, &dir->creationTime);
+  } else {
+    // use default date/time
+    dir->creationDate = FAT_DEFAULT_DATE;
+    dir->creationTime = FAT_DEFAULT_TIME;
+  }
+  dir->lastAccessDate = dir->creationDate;
+  dir->lastWriteDate = dir->creationDate;
+  dir->lastWriteTime = dir->creationTime;
+
+  // Force write of entry to device.
+  dirFile->m_vol->cacheDirty();
+
+  // open entry in cache.
+  return openCachedEntry(dirFile, index, oflag, 0);
+
 fail:
   return false;
 }
@@ -163,6 +291,11 @@ bool FatFile::dirEntry(dir_t* dst) {
     DBG_FAIL_MACRO;
     goto fail;
   }
+#if ENABLE_EXFAT
+  if (m_vol->isExFat()) {
+    return exFatDirEntry(dst);
+  }
+#endif  // ENABLE_EXFAT
   // read entry
   dir = cacheDirEntry(FatCache::CACHE_FOR_READ);
   if (!dir) {
@@ -208,6 +341,11 @@ uint32_t FatFile::dirSize() {
   if (isRootFixed()) {
     return 32*m_vol->rootDirEntryCount();
   }
+#if ENABLE_EXFAT
+  if (m_flags & F_NO_FAT_CHAIN) {
+    return m_fileSize;
+  }
+#endif  // ENABLE_EXFAT
   uint16_t n = 0;
   uint32_t c = isRoot32() ? m_vol->rootDirStart() : m_firstCluster;
   do {
@@ -305,6 +443,13 @@ bool FatFile::mkdir(FatFile* parent, fname_t* fname) {
     DBG_FAIL_MACRO;
     goto fail;
   }
+#if ENABLE_EXFAT
+  // Directories aren't created on exFAT.
+  if (parent->m_vol->isExFat()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+#endif  // ENABLE_EXFAT
   // create a normal file
   if (!open(parent, fname, O_CREAT | O_EXCL | O_RDWR)) {
     DBG_FAIL_MACRO;
@@ -365,6 +510,22 @@ fail:
   return false;
 }
 //------------------------------------------------------------------------------
+// Advance m_curCluster to the next cluster of the file.
+// Return -1 for an error, zero at the end of the chain, else one.
+int8_t FatFile::nextCluster() {
+#if ENABLE_EXFAT
+  if (m_flags & F_NO_FAT_CHAIN) {
+    // contiguous, the next cluster exists if the file extends into it
+    if (m_curPosition >= m_fileSize) {
+      return 0;
+    }
+    m_curCluster++;
+    return 1;
+  }
+#endif  // ENABLE_EXFAT
+  return m_vol->fatGet(m_curCluster, &m_curCluster);
+}
+//------------------------------------------------------------------------------
 bool FatFile::open(FatFileSystem* fs, const char* path, uint8_t oflag) {
   return open(fs->vwd(), path, oflag);
 }
@@ -429,6 +590,11 @@ bool FatFile::open(FatFile* dirFile, uint16_t index, uint8_t oflag) {
     DBG_FAIL_MACRO;
     goto fail;
   }
+#if ENABLE_EXFAT
+  if (dirFile->m_vol->isExFat()) {
+    return exFatOpenSet(dirFile, index, oflag);
+  }
+#endif  // ENABLE_EXFAT
   if (index) {
     // Check for LFN.
     if (!dirFile->seekSet(32UL*(index -1))) {
@@ -509,6 +675,10 @@ bool FatFile::openCachedEntry(FatFile* dirFile, uint16_t dirIndex,
   }
   // save open flags for read/write
   m_flags = oflag & F_OFLAG;
+  m_extentClusters = 0;
+#if FILE_EXTENT_MAP_SIZE
+  m_extentMapCount = 0;
+#endif  // FILE_EXTENT_MAP_SIZE
 
   m_dirBlock = m_vol->cacheBlockNumber();
 
@@ -549,6 +719,39 @@ bool FatFile::openNext(FatFile* dirFile, uint8_t oflag) {
     DBG_FAIL_MACRO;
     goto fail;
   }
+#if ENABLE_EXFAT
+  while (dirFile->m_vol->isExFat()) {
+    index = dirFile->curPosition()/32;
+    uint8_t* p = reinterpret_cast<uint8_t*>(dirFile->readDirCache());
+    if (!p) {
+      if (dirFile->getError()) {
+        DBG_FAIL_MACRO;
+      }
+      goto fail;
+    }
+    // done if end of directory
+    if (p[0] == 0) {
+      goto fail;
+    }
+    // skip all but the first entry of a set
+    if (p[0] != EXFAT_TYPE_FILE) {
+      continue;
+    }
+    uint8_t count = p[1];
+    if (exFatOpenSet(dirFile, index, oflag)) {
+      return dirFile->seekSet(32UL*(index + 1 + count));
+    }
+    if (dirFile->getError()) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    // skip a set that can't be opened with oflag
+    if (!dirFile->seekSet(32UL*(index + 1 + count))) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+  }
+#endif  // ENABLE_EXFAT
   while (1) {
     // read entry into cache
     index = dirFile->curPosition()/32;
@@ -609,6 +812,13 @@ bool FatFile::openParent(FatFile* dirFile) {
   if (isOpen() || !dirFile->isOpen()) {
     goto fail;
   }
+#if ENABLE_EXFAT
+  // exFAT has no '..' entry.
+  if (dirFile->m_vol->isExFat()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+#endif  // ENABLE_EXFAT
   if (dirFile->m_dirCluster == 0) {
     return openRoot(dirFile->m_vol);
   }
@@ -668,6 +878,9 @@ bool FatFile::openRoot(FatVolume* vol) {
     break;
 
   case 32:
+#if ENABLE_EXFAT
+  case 64:
+#endif  // ENABLE_EXFAT
     m_attr = FILE_ATTR_ROOT32;
     break;
 
@@ -693,9 +906,56 @@ int FatFile::peek() {
   return c;
 }
 //------------------------------------------------------------------------------
+bool FatFile::preErase(uint32_t size, uint32_t skip) {
+  uint32_t cluster = m_curCluster ? m_curCluster : m_firstCluster;
+  uint32_t next;
+  int8_t fg;
+
+  if (!isFile()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  if (cluster == 0) {
+    // empty file, allocation takes the first free cluster after the
+    // search start
+    for (cluster = m_vol->m_allocSearchStart;
+         cluster < m_vol->m_lastCluster; cluster++) {
+      fg = m_vol->isFree(cluster + 1);
+      if (fg < 0) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      if (fg) {
+        break;
+      }
+    }
+#if ENABLE_EXFAT
+  } else if (m_flags & F_NO_FAT_CHAIN) {
+    // the last cluster follows from the size
+    cluster = m_firstCluster
+              + ((m_fileSize - 1) >> (m_vol->clusterSizeShift() + 9));
+#endif  // ENABLE_EXFAT
+  } else {
+    // find the last cluster of the file
+    while ((fg = m_vol->fatGet(cluster, &next)) > 0) {
+      cluster = next;
+    }
+    if (fg < 0) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+  }
+  skip >>= m_vol->clusterSizeShift() + 9;
+  return m_vol->eraseFree(cluster + 1 + skip,
+                          size >> (m_vol->clusterSizeShift() + 9));
+
+fail:
+  return false;
+}
+//------------------------------------------------------------------------------
 int FatFile::read(void* buf, size_t nbyte) {
   int8_t fg;
-  uint8_t blockOfCluster = 0;
+  uint16_t blockOfCluster = 0;
   uint8_t* dst = reinterpret_cast<uint8_t*>(buf);
   uint16_t offset;
   size_t toRead;
@@ -734,7 +994,7 @@ int FatFile::read(void* buf, size_t nbyte) {
           m_curCluster = isRoot32() ? m_vol->rootDirStart() : m_firstCluster;
         } else {
           // get next cluster from FAT
-          fg = m_vol->fatGet(m_curCluster, &m_curCluster);
+          fg = nextCluster();
           if (fg < 0) {
             DBG_FAIL_MACRO;
             goto fail;
@@ -750,7 +1010,7 @@ int FatFile::read(void* buf, size_t nbyte) {
       }
       block = m_vol->clusterStartBlock(m_curCluster) + blockOfCluster;
     }
-    if (offset != 0 || toRead < 512 || block == m_vol->cacheBlockNumber()) {
+    if (offset != 0 || toRead < 512 || m_vol->cacheInRange(block, 1)) {
       // amount to be read from current block
       n = 512 - offset;
       if (n > toRead) {
@@ -766,16 +1026,15 @@ int FatFile::read(void* buf, size_t nbyte) {
       memcpy(dst, src, n);
 #if USE_MULTI_BLOCK_IO
     } else if (toRead >= 1024) {
-      uint8_t nb = toRead >> 9;
+      size_t nb = toRead >> 9;
       if (!isRootFixed()) {
-        uint8_t mb = m_vol->blocksPerCluster() - blockOfCluster;
+        uint16_t mb = m_vol->blocksPerCluster() - blockOfCluster;
         if (mb < nb) {
           nb = mb;
         }
       }
       n = 512*nb;
-      if (m_vol->cacheBlockNumber() <= block
-          && block < (m_vol->cacheBlockNumber() + nb)) {
+      if (m_vol->cacheInRange(block, nb)) {
         // flush cache if a block is in the cache
         if (!m_vol->cacheSync()) {
           DBG_FAIL_MACRO;
@@ -812,6 +1071,16 @@ int8_t FatFile::readDir(dir_t* dir) {
   if (!isDir() || (0X1F & m_curPosition)) {
     return -1;
   }
+#if ENABLE_EXFAT
+  if (m_vol->isExFat()) {
+    // Build a FAT entry for the next file, see dirEntry().
+    FatFile file;
+    if (!file.openNext(this, O_READ)) {
+      return getError() ? -1 : 0;
+    }
+    return file.exFatDirEntry(dir) ? sizeof(dir_t) : -1;
+  }
+#endif  // ENABLE_EXFAT
 
   while (1) {
     n = read(dir, sizeof(dir_t));
@@ -892,6 +1161,13 @@ bool FatFile::rename(FatFile* dirFile, const char* newPath) {
     DBG_FAIL_MACRO;
     goto fail;
   }
+#if ENABLE_EXFAT
+  // Directory changes aren't supported on exFAT.
+  if (m_vol->isExFat()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+#endif  // ENABLE_EXFAT
   // Can't move file to new volume.
   if (m_vol != dirFile->m_vol) {
     DBG_FAIL_MACRO;
@@ -968,6 +1244,11 @@ bool FatFile::rename(FatFile* dirFile, const char* newPath) {
     memcpy(&pc->dir[1], &entry, sizeof(entry));
   }
   // Remove old directory entry;
+#if DIR_INDEX_SIZE
+  if (m_vol->m_dirIndexCluster == oldFile.m_dirCluster) {
+    m_vol->dirIndexPut(oldFile.m_dirIndex, 0);
+  }
+#endif  // DIR_INDEX_SIZE
   oldFile.m_firstCluster = 0;
   oldFile.m_flags = O_WRITE;
   oldFile.m_attr = FILE_ATTR_FILE;
@@ -987,6 +1268,13 @@ bool FatFile::rmdir() {
     DBG_FAIL_MACRO;
     goto fail;
   }
+#if ENABLE_EXFAT
+  // Directory changes aren't supported on exFAT.
+  if (m_vol->isExFat()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+#endif  // ENABLE_EXFAT
   rewind();
 
   // make sure directory is empty
@@ -1030,6 +1318,13 @@ bool FatFile::rmRfStar() {
     DBG_FAIL_MACRO;
     goto fail;
   }
+#if ENABLE_EXFAT
+  // Directory changes aren't supported on exFAT.
+  if (m_vol->isExFat()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+#endif  // ENABLE_EXFAT
   rewind();
   while (1) {
     // remember position
@@ -1094,6 +1389,158 @@ bool FatFile::rmRfStar() {
   }
   return true;
 
+fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+bool FatFile::rmMatching(bool (*match)(const char* name, const void* arg),
+                         const void* arg, uint16_t* count) {
+  // First clusters of removed files not yet freed.
+  uint32_t chain[4];
+  uint8_t nChain = 0;
+  uint16_t index;
+  uint16_t lfnIndex = 0XFFFF;
+  uint8_t lfnSum = 0;
+  char name[13];
+  dir_t* dir;
+  ldir_t* ldir;
+
+  *count = 0;
+  if (!isDir()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  rewind();
+#if ENABLE_EXFAT
+  if (m_vol->isExFat()) {
+    // Directories and read-only files don't open for write and are skipped.
+    FatFile file;
+    while (file.openNext(this, O_WRITE)) {
+      if (!file.getSFN(name)) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      if (!match(name, arg)) {
+        file.close();
+        continue;
+      }
+      if (!file.remove()) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      (*count)++;
+    }
+    if (getError()) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    return true;
+  }
+#endif  // ENABLE_EXFAT
+  while (1) {
+    index = m_curPosition/32;
+    dir = readDirCache();
+    if (!dir) {
+      // At EOF if no error.
+      if (!getError()) {
+        break;
+      }
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    // done if past last entry
+    if (dir->name[0] == DIR_NAME_FREE) {
+      break;
+    }
+    // track the long name entries in front of each short entry
+    if (DIR_IS_LONG_NAME(dir) && dir->name[0] != DIR_NAME_DELETED) {
+      ldir = reinterpret_cast<ldir_t*>(dir);
+      if (ldir->ord & LDIR_ORD_LAST_LONG_ENTRY) {
+        lfnIndex = index;
+        lfnSum = ldir->chksum;
+      } else if (ldir->chksum != lfnSum) {
+        lfnIndex = 0XFFFF;
+      }
+      continue;
+    }
+    if (dir->name[0] == DIR_NAME_DELETED || dir->name[0] == '.'
+        || !DIR_IS_FILE(dir) || (dir->attributes & DIR_ATT_READ_ONLY)) {
+      lfnIndex = 0XFFFF;
+      continue;
+    }
+    dirName(dir, name);
+    if (!match(name, arg)) {
+      lfnIndex = 0XFFFF;
+      continue;
+    }
+    if (lfnIndex != 0XFFFF && lfnSum != lfnChecksum(dir->name)) {
+      lfnIndex = 0XFFFF;
+    }
+    // free clusters of the last batch before this entry is lost
+    if (nChain == sizeof(chain)/sizeof(chain[0])) {
+      while (nChain) {
+        if (!m_vol->freeChain(chain[--nChain])) {
+          DBG_FAIL_MACRO;
+          goto fail;
+        }
+      }
+      if (!seekSet(32UL*index)) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      dir = readDirCache();
+      if (!dir) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+    }
+    if (dir->firstClusterLow || dir->firstClusterHigh) {
+      chain[nChain++] = (uint32_t)dir->firstClusterHigh << 16
+                        | dir->firstClusterLow;
+    }
+    // Mark entry and any long name entries in this block deleted.
+    dir->name[0] = DIR_NAME_DELETED;
+    for (uint16_t i = index; i-- > lfnIndex && (i & 0XF) != 0XF;) {
+      dir--;
+      dir->name[0] = DIR_NAME_DELETED;
+    }
+    m_vol->cacheDirty();
+#if DIR_INDEX_SIZE
+    if (m_vol->m_dirIndexCluster == m_firstCluster) {
+      m_vol->dirIndexPut(index, 0);
+    }
+#endif  // DIR_INDEX_SIZE
+    (*count)++;
+    if (lfnIndex < (index & ~0XF)) {
+      // long name starts in an earlier block
+      for (uint16_t i = lfnIndex; i < (index & ~0XF); i++) {
+        if (!seekSet(32UL*i)) {
+          DBG_FAIL_MACRO;
+          goto fail;
+        }
+        dir = readDirCache();
+        if (!dir) {
+          DBG_FAIL_MACRO;
+          goto fail;
+        }
+        dir->name[0] = DIR_NAME_DELETED;
+        m_vol->cacheDirty();
+      }
+      if (!seekSet(32UL*(index + 1))) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+    }
+    lfnIndex = 0XFFFF;
+  }
+  while (nChain) {
+    if (!m_vol->freeChain(chain[--nChain])) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+  }
+  return m_vol->cacheSync();
+
 fail:
   return false;
 }
@@ -1127,7 +1574,61 @@ bool FatFile::seekSet(uint32_t pos) {
   // calculate cluster index for cur and new position
   nCur = (m_curPosition - 1) >> (m_vol->clusterSizeShift() + 9);
   nNew = (pos - 1) >> (m_vol->clusterSizeShift() + 9);
+#if ENABLE_EXFAT
+  if (m_flags & F_NO_FAT_CHAIN) {
+    // exFAT clusters are contiguous
+    m_curCluster = m_firstCluster + nNew;
+    goto done;
+  }
+#endif  // ENABLE_EXFAT
 
+#if FILE_EXTENT_MAP_SIZE
+  if (isFile()) {
+    if (m_extentMapCount == 0) {
+#if FILE_EXTENT_MAP_SIZE > 1
+      m_extentMapIndex[0] = 0;
+#endif  // FILE_EXTENT_MAP_SIZE > 1
+      m_extentMapCluster[0] = m_firstCluster;
+      m_extentMapEnd = 1;
+      m_extentMapCount = 1;
+    }
+    uint8_t i = m_extentMapCount - 1;
+    if (nNew < m_extentMapEnd) {
+      // new position is in a mapped run
+      while (extentMapIndex(i) > nNew) {
+        i--;
+      }
+      m_curCluster = m_extentMapCluster[i] + nNew - extentMapIndex(i);
+      goto done;
+    }
+    if (m_curPosition == 0 || nCur < m_extentMapEnd || nNew < nCur) {
+      // follow chain from last mapped cluster
+      nCur = m_extentMapEnd - 1;
+      m_curCluster = m_extentMapCluster[i] + nCur - extentMapIndex(i);
+    }
+    while (nCur < nNew) {
+      uint32_t prev = m_curCluster;
+      if (m_vol->fatGet(m_curCluster, &m_curCluster) <= 0) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      // add cluster to map if it follows the last mapped cluster
+      if (++nCur == m_extentMapEnd) {
+        if (m_curCluster != prev + 1) {
+          if (m_extentMapCount == FILE_EXTENT_MAP_SIZE) {
+            continue;
+          }
+#if FILE_EXTENT_MAP_SIZE > 1
+          m_extentMapIndex[m_extentMapCount] = nCur;
+          m_extentMapCluster[m_extentMapCount++] = m_curCluster;
+#endif  // FILE_EXTENT_MAP_SIZE > 1
+        }
+        m_extentMapEnd++;
+      }
+    }
+    goto done;
+  }
+#endif  // FILE_EXTENT_MAP_SIZE
   if (nNew < nCur || m_curPosition == 0) {
     // must follow chain from first cluster
     m_curCluster = isRoot32() ? m_vol->rootDirStart() : m_firstCluster;
@@ -1151,6 +1652,13 @@ fail:
   return false;
 }
 //------------------------------------------------------------------------------
+void FatFile::setExtentSize(uint32_t size) {
+  if (isOpen()) {
+    size >>= m_vol->clusterSizeShift() + 9;
+    m_extentClusters = size < 0XFFFF ? size : 0XFFFF;
+  }
+}
+//------------------------------------------------------------------------------
 void FatFile::setpos(FatPos_t* pos) {
   m_curPosition = pos->position;
   m_curCluster = pos->cluster;
@@ -1160,7 +1668,12 @@ bool FatFile::sync() {
   if (!isOpen()) {
     return true;
   }
-
+#if ENABLE_EXFAT
+  if ((m_flags & F_FILE_DIR_DIRTY) && m_vol->isExFat() && !exFatSyncEntry()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+#endif  // ENABLE_EXFAT
   if (m_flags & F_FILE_DIR_DIRTY) {
     dir_t* dir = cacheDirEntry(FatCache::CACHE_FOR_WRITE);
     // check for deleted by another open file object
@@ -1204,6 +1717,13 @@ bool FatFile::timestamp(FatFile* file) {
     DBG_FAIL_MACRO;
     goto fail;
   }
+#if ENABLE_EXFAT
+  // exFAT timestamps are only set by sync().
+  if (m_vol->isExFat()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+#endif  // ENABLE_EXFAT
   // update directory fields
   if (!sync()) {
     DBG_FAIL_MACRO;
@@ -1248,6 +1768,13 @@ bool FatFile::timestamp(uint8_t flags, uint16_t year, uint8_t month,
     DBG_FAIL_MACRO;
     goto fail;
   }
+#if ENABLE_EXFAT
+  // exFAT timestamps are only set by sync().
+  if (m_vol->isExFat()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+#endif  // ENABLE_EXFAT
   // update directory entry
   if (!sync()) {
     DBG_FAIL_MACRO;
@@ -1291,8 +1818,8 @@ bool FatFile::truncate(uint32_t length) {
     DBG_FAIL_MACRO;
     goto fail;
   }
-  // fileSize and length are zero - nothing to do
-  if (m_fileSize == 0) {
+  // no clusters - nothing to do
+  if (m_firstCluster == 0) {
     return true;
   }
 
@@ -1304,6 +1831,21 @@ bool FatFile::truncate(uint32_t length) {
     DBG_FAIL_MACRO;
     goto fail;
   }
+#if ENABLE_EXFAT
+  if (m_flags & F_NO_FAT_CHAIN) {
+    // keep the clusters that hold length bytes
+    uint32_t keep = length ?
+                    ((length - 1) >> (m_vol->clusterSizeShift() + 9)) + 1 : 0;
+    if (!exFatFree(keep, m_fileSize)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    if (keep == 0) {
+      m_firstCluster = 0;
+      m_flags &= ~F_NO_FAT_CHAIN;
+    }
+  } else
+#endif  // ENABLE_EXFAT
   if (length == 0) {
     // free all clusters
     if (!m_vol->freeChain(m_firstCluster)) {
@@ -1332,6 +1874,11 @@ bool FatFile::truncate(uint32_t length) {
     }
   }
   m_fileSize = length;
+  m_flags &= ~F_FILE_EXTENT;
+#if FILE_EXTENT_MAP_SIZE
+  // freed clusters may be in the map
+  m_extentMapCount = 0;
+#endif  // FILE_EXTENT_MAP_SIZE
 
   // need to update directory entry
   m_flags |= F_FILE_DIR_DIRTY;
@@ -1373,12 +1920,12 @@ int FatFile::write(const void* buf, size_t nbyte) {
     goto fail;
   }
   while (nToWrite) {
-    uint8_t blockOfCluster = m_vol->blockOfCluster(m_curPosition);
+    uint16_t blockOfCluster = m_vol->blockOfCluster(m_curPosition);
     uint16_t blockOffset = m_curPosition & 0X1FF;
     if (blockOfCluster == 0 && blockOffset == 0) {
       // start of new cluster
       if (m_curCluster != 0) {
-        int8_t fg = m_vol->fatGet(m_curCluster, &m_curCluster);
+        int8_t fg = nextCluster();
         if (fg < 0) {
           DBG_FAIL_MACRO;
           goto fail;
@@ -1405,6 +1952,11 @@ int FatFile::write(const void* buf, size_t nbyte) {
     }
     // block for data write
     uint32_t block = m_vol->clusterStartBlock(m_curCluster) + blockOfCluster;
+    if (m_curPosition >= m_fileSize) {
+      // Appending, the rest of the cluster holds no data.
+      m_vol->setEraseRange(block, block + m_vol->blocksPerCluster() - 1
+                           - blockOfCluster);
+    }
 
     if (blockOffset != 0 || nToWrite < 512) {
       // partial block - must use cache
@@ -1439,17 +1991,14 @@ int FatFile::write(const void* buf, size_t nbyte) {
 #if USE_MULTI_BLOCK_IO
     } else if (nToWrite >= 1024) {
       // use multiple block write command
-      uint8_t maxBlocks = m_vol->blocksPerCluster() - blockOfCluster;
-      uint8_t nBlock = nToWrite >> 9;
+      uint16_t maxBlocks = m_vol->blocksPerCluster() - blockOfCluster;
+      size_t nBlock = nToWrite >> 9;
       if (nBlock > maxBlocks) {
         nBlock = maxBlocks;
       }
       n = 512*nBlock;
-      if (m_vol->cacheBlockNumber() <= block
-          && block < (m_vol->cacheBlockNumber() + nBlock)) {
-        // invalidate cache if block is in cache
-        m_vol->cacheInvalidate();
-      }
+      // invalidate cache if block is in cache
+      m_vol->cacheInvalidateRange(block, nBlock);
       if (!m_vol->writeBlocks(block, src, nBlock)) {
         DBG_FAIL_MACRO;
         goto fail;
@@ -1458,9 +2007,7 @@ int FatFile::write(const void* buf, size_t nbyte) {
     } else {
       // use single block write command
       n = 512;
-      if (m_vol->cacheBlockNumber() == block) {
-        m_vol->cacheInvalidate();
-      }
+      m_vol->cacheInvalidateRange(block, 1);
       if (!m_vol->writeBlock(block, src)) {
         DBG_FAIL_MACRO;
         goto fail;
@@ -1470,6 +2017,7 @@ int FatFile::write(const void* buf, size_t nbyte) {
     src += n;
     nToWrite -= n;
   }
+  m_vol->setEraseRange(0, 0);
   if (m_curPosition > m_fileSize) {
     // update fileSize and insure sync will update dir entry
     m_fileSize = m_curPosition;
@@ -1488,6 +2036,7 @@ int FatFile::write(const void* buf, size_t nbyte) {
   return nbyte;
 
 fail:
+  m_vol->setEraseRange(0, 0);
   // return for write error
   m_error |= WRITE_ERROR;
   return -1;
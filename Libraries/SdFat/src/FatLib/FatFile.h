@@ -232,6 +232,26 @@ class FatFile {
    */
   bool createContiguous(FatFile* dirFile,
                         const char* path, uint32_t size);
+  /** Create and open a new file without searching the directory for the
+   * name.  For use right after listing a directory that doesn't hold the
+   * name, so the directory isn't read a second time.
+   *
+   * The first free entry at or after \a index is used, a cluster is added
+   * to the directory if there is none.  Names that need long name entries,
+   * and exFAT volumes, are created by a full search as with O_EXCL.
+   *
+   * \param[in] dirFile The directory where the file will be created.
+   * \param[in] name A file name, no path.
+   * \param[in] index The first entry that may be free, for example the
+   * entry readDir() returned zero at.
+   * \param[in] oflag Open flags, must include O_WRITE.  O_CREAT and O_EXCL
+   * are implied.
+   *
+   * \return The value true is returned for success and
+   * the value false, is returned for failure.
+   */
+  bool createAt(FatFile* dirFile, const char* name, uint16_t index,
+                uint8_t oflag);
   /** \return The current cluster number for a file or directory. */
   uint32_t curCluster() const {
     return m_curCluster;
@@ -581,6 +601,26 @@ class FatFile {
    * \return The byte if no error and not at eof else -1;
    */
   int peek();
+  /** Ask the card to erase the free clusters that will hold the next data
+   * written past the last cluster of the file.  A card that doesn't have to
+   * erase while writing has a lower write latency.
+   *
+   * Only free clusters that directly follow the file, or the allocation
+   * search start for an empty file, are erased.  Those are the clusters
+   * allocation picks next.  Erase is a hint, a card that
+   * can't erase the range just returns false.
+   *
+   * The card is busy until the erase is done, so a large erase can be done
+   * in steps, with skip set to the bytes erased by earlier steps.
+   *
+   * \param[in] size Bytes to erase, rounded down to whole clusters.
+   * \param[in] skip Bytes of clusters after the file to leave as they are,
+   * rounded down to whole clusters.
+   *
+   * \return The value true is returned for success and
+   * the value false is returned for failure.
+   */
+  bool preErase(uint32_t size, uint32_t skip = 0);
   /** Print a file's creation date and time
    *
    * \param[in] pr Print stream for output.
@@ -772,6 +812,23 @@ class FatFile {
    * the value false is returned for failure.
    */
   bool rmRfStar();
+  /** Remove files in this directory whose 8.3 names match.
+   *
+   * Entries are marked deleted in place during a single pass over the
+   * directory and the files' clusters are freed in batches.  Read-only
+   * files and subdirectories are not removed.  No file to be removed
+   * may be open.
+   *
+   * \param[in] match Called with each file's 8.3 name, in the form
+   * returned by getSFN(), and \a arg.  Returns true to remove the file.
+   * \param[in] arg Passed to \a match.
+   * \param[out] count Number of files removed.
+   *
+   * \return The value true is returned for success and
+   * the value false is returned for failure.
+   */
+  bool rmMatching(bool (*match)(const char* name, const void* arg),
+                  const void* arg, uint16_t* count);
   /** Set the files position to current position + \a pos. See seekSet().
    * \param[in] offset The new position in bytes from the current position.
    * \return true for success or false for failure.
@@ -808,6 +865,18 @@ class FatFile {
     m_cwd = dir;
     return true;
   }
+  /** Set the amount of space to reserve each time a write extends a file
+   * past its last allocated cluster.  Clusters are allocated in one FAT
+   * pass, contiguous with the new cluster while free clusters follow it.
+   * Unused reserved clusters are freed by close() and truncate().
+   *
+   * Clusters reserved past end of file are not freed by sync() so they
+   * will be lost if power fails before the file is closed.
+   *
+   * \param[in] size Bytes to reserve, rounded down to whole clusters.
+   * Zero or less than one cluster allocates a single cluster at a time.
+   */
+  void setExtentSize(uint32_t size);
   /** The sync() call causes all modified data and directory fields
    * to be written to the storage device.
    *
@@ -949,11 +1018,28 @@ class FatFile {
   bool addCluster();
   bool addDirCluster();
   dir_t* cacheDirEntry(uint8_t action);
+#if ENABLE_EXFAT
+  bool exFatAddCluster();
+  bool exFatChecksumSet(uint16_t index);
+  bool exFatDirEntry(dir_t* dir);
+  bool exFatFree(uint32_t keep, uint32_t size);
+  int16_t exFatNameChar(uint8_t k);
+  bool exFatOpen(FatFile* dirFile, fname_t* fname, uint8_t oflag);
+  bool exFatOpenSet(FatFile* dirFile, uint16_t index, uint8_t oflag);
+  int16_t exFatReadSet(FatFile* dirFile, dir_t* dir);
+  bool exFatRemove();
+  bool exFatSyncEntry();
+#endif  // ENABLE_EXFAT
+#if DIR_INDEX_SIZE
+  static uint8_t dirIndexHash(uint8_t* name);
+  static uint8_t dirIndexValue(dir_t* dir);
+#endif  // DIR_INDEX_SIZE
   static uint8_t lfnChecksum(uint8_t* name);
   bool lfnUniqueSfn(fname_t* fname);
   bool openCluster(FatFile* file);
   static bool parsePathName(const char* str, fname_t* fname, const char** ptr);
   bool mkdir(FatFile* parent, fname_t* fname);
+  int8_t nextCluster();
   bool open(FatFile* dirFile, fname_t* fname, uint8_t oflag);
   bool openCachedEntry(FatFile* dirFile, uint16_t cacheIndex, uint8_t oflag,
                        uint8_t lfnOrd);
@@ -964,6 +1050,12 @@ class FatFile {
   // bits defined in m_flags
   // should be 0X0F
   static uint8_t const F_OFLAG = (O_ACCMODE | O_APPEND | O_SYNC);
+  // exFAT clusters are contiguous and not in the FAT
+  static uint8_t const F_NO_FAT_CHAIN = 0X10;
+  // exFAT parent directory has F_NO_FAT_CHAIN set
+  static uint8_t const F_DIR_NO_FAT_CHAIN = 0X20;
+  // clusters may be allocated past end of file
+  static uint8_t const F_FILE_EXTENT = 0X40;
   // sync of directory entry required
   static uint8_t const F_FILE_DIR_DIRTY = 0X80;
 
@@ -979,6 +1071,7 @@ class FatFile {
   uint8_t    m_flags;            // See above for definition of m_flags bits
   uint8_t    m_lfnOrd;
   uint16_t   m_dirIndex;         // index of directory entry in dir file
+  uint16_t   m_extentClusters;   // clusters to allocate when file grows
   FatVolume* m_vol;              // volume where file is located
   uint32_t   m_dirCluster;
   uint32_t   m_curCluster;       // cluster for current file position
@@ -986,5 +1079,22 @@ class FatFile {
   uint32_t   m_dirBlock;         // block for this files directory entry
   uint32_t   m_fileSize;         // file size in bytes
   uint32_t   m_firstCluster;     // first cluster of file
+#if FILE_EXTENT_MAP_SIZE
+  // Runs of contiguous clusters from the start of the file, built by seekSet.
+  uint8_t    m_extentMapCount;   // number of runs in the map
+  uint32_t   m_extentMapEnd;     // number of file clusters mapped
+  uint32_t   m_extentMapCluster[FILE_EXTENT_MAP_SIZE];  // volume cluster
+#if FILE_EXTENT_MAP_SIZE > 1
+  uint32_t   m_extentMapIndex[FILE_EXTENT_MAP_SIZE];    // file cluster index
+  uint32_t extentMapIndex(uint8_t i) {
+    return m_extentMapIndex[i];
+  }
+#else  // FILE_EXTENT_MAP_SIZE > 1
+  // The only run starts at the first cluster of the file.
+  uint32_t extentMapIndex(uint8_t i) {
+    return 0;
+  }
+#endif  // FILE_EXTENT_MAP_SIZE > 1
+#endif  // FILE_EXTENT_MAP_SIZE
 };
 #endif  // FatFile_h
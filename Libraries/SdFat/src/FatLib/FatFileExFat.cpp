@@ -0,0 +1,610 @@
+/* FatLib Library
+ * Copyright (C) 2012 by William Greiman
+ *
+ * This file is part of the FatLib Library
+ *
+ * This Library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the FatLib Library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "FatFile.h"
+#if ENABLE_EXFAT
+//------------------------------------------------------------------------------
+// exFAT files.
+//
+// A file is a set of directory entries: a file entry with the attributes
+// and timestamps, a stream entry with the first cluster and size, then
+// names entries with 15 UTF-16 characters each.  A checksum covers the set.
+//
+// Clusters are marked used in the allocation bitmap.  A file whose
+// clusters are contiguous has F_NO_FAT_CHAIN set and no FAT chain.  If
+// a file can't grow contiguous its clusters are linked in the FAT and it
+// is then handled like a FAT32 file.
+//
+// Names are compared without case for ASCII only and characters above
+// 0X7E read as '?'.
+//------------------------------------------------------------------------------
+// One step of the exFAT set checksum and name hash.
+static uint16_t exFatSum(uint16_t sum, uint8_t b) {
+  return ((sum & 1) ? 0X8000 : 0) + (sum >> 1) + b;
+}
+//------------------------------------------------------------------------------
+inline char exFatToUpper(char c) {
+  return 'a' <= c && c <= 'z' ? c - 'a' + 'A' : c;
+}
+//------------------------------------------------------------------------------
+// Add a cluster, contiguous if possible.
+bool FatFile::exFatAddCluster() {
+  uint32_t cluster;
+  if (!m_vol->exFatAllocate(m_curCluster ? m_curCluster + 1 : 0, &cluster)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  if (m_curCluster == 0) {
+    // first cluster of a file
+    m_flags |= F_NO_FAT_CHAIN;
+  } else if (!(m_flags & F_NO_FAT_CHAIN) || cluster != m_curCluster + 1) {
+    if (m_flags & F_NO_FAT_CHAIN) {
+      // not contiguous, link the clusters so far in the FAT
+      for (uint32_t c = m_firstCluster; c < m_curCluster; c++) {
+        if (!m_vol->fatPut(c, c + 1)) {
+          DBG_FAIL_MACRO;
+          goto fail;
+        }
+      }
+      m_flags &= ~F_NO_FAT_CHAIN;
+    }
+    if (!m_vol->fatPutEOC(cluster) || !m_vol->fatPut(m_curCluster, cluster)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+  }
+  m_curCluster = cluster;
+  return true;
+
+fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+// Set the checksum of the entry set at index in this directory.
+bool FatFile::exFatChecksumSet(uint16_t index) {
+  uint16_t sum = 0;
+  uint8_t count = 0;
+  uint8_t* p;
+  if (!seekSet(32UL*index)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  for (uint8_t i = 0; i <= count; i++) {
+    p = reinterpret_cast<uint8_t*>(readDirCache());
+    if (!p) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    if (i == 0) {
+      count = p[1];
+    }
+    for (uint8_t j = 0; j < 32; j++) {
+      // skip the checksum field
+      if (i || j < 2 || j > 3) {
+        sum = exFatSum(sum, p[j]);
+      }
+    }
+  }
+  if (!seekSet(32UL*index)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  p = reinterpret_cast<uint8_t*>(readDirCache());
+  if (!p) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  reinterpret_cast<exfat_file_t*>(p)->setChecksum = sum;
+  m_vol->cacheDirty();
+  return true;
+
+fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+// Fill a FAT directory entry for the file.  The 8.3 name is made like
+// Windows makes one for a long name, with "~1" if characters are lost.
+bool FatFile::exFatDirEntry(dir_t* dir) {
+  FatFile dirFile;
+  bool dot = false;
+  bool lost = false;
+  uint8_t nChar = 0;
+  uint8_t nBase = 0;
+  uint8_t lc = 0;
+  uint8_t uc = 0;
+  int16_t len;
+
+  memset(dir, 0, sizeof(dir_t));
+  memset(dir->name, ' ', sizeof(dir->name));
+  len = exFatReadSet(&dirFile, dir);
+  if (len < 0) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  for (uint8_t k = 0; k < len; k++) {
+    int16_t c = dirFile.exFatNameChar(k);
+    if (c < 0) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    if (c == '.' && nChar) {
+      // start of a new extension, only the last is used
+      lost |= dot;
+      dot = true;
+      nBase = nChar;
+      memset(dir->name + 8, ' ', 3);
+      continue;
+    }
+    if (c == ' ' || c == '.') {
+      // leading dots and all spaces are dropped
+      lost = true;
+      continue;
+    }
+    if (!legal83Char(c)) {
+      lost = true;
+      c = '_';
+    }
+    uint8_t bit = dot ? DIR_NT_LC_EXT : DIR_NT_LC_BASE;
+    if ('a' <= c && c <= 'z') {
+      c += 'A' - 'a';
+      lc |= bit;
+    } else if ('A' <= c && c <= 'Z') {
+      uc |= bit;
+    }
+    if (dot && nChar - nBase < 3) {
+      dir->name[8 + nChar - nBase] = c;
+    }
+    if (nChar < 8) {
+      dir->name[nChar] = c;
+    }
+    nChar++;
+  }
+  if (!dot) {
+    nBase = nChar;
+  } else if (nChar - nBase > 3) {
+    lost = true;
+  }
+  if (nBase > 8) {
+    lost = true;
+  }
+  // remove extension characters stored in the base
+  for (uint8_t i = nBase; i < 8; i++) {
+    dir->name[i] = ' ';
+  }
+  if (lost) {
+    uint8_t i = nBase < 6 ? nBase : 6;
+    dir->name[i] = '~';
+    dir->name[i + 1] = '1';
+  } else if (!(lc & uc)) {
+    dir->reservedNT = lc;
+  }
+  dir->attributes = m_attr & FILE_ATTR_COPY;
+  dir->firstClusterLow = m_firstCluster & 0XFFFF;
+  dir->firstClusterHigh = m_firstCluster >> 16;
+  if (isFile()) {
+    dir->fileSize = m_fileSize;
+  }
+  return true;
+
+fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+// Free the clusters after the first keep clusters.  size is the size the
+// clusters were allocated for.  keep must be zero if there is a FAT chain.
+bool FatFile::exFatFree(uint32_t keep, uint32_t size) {
+  if (!(m_flags & F_NO_FAT_CHAIN)) {
+    return m_vol->freeChain(m_firstCluster);
+  }
+  uint32_t n = size ? ((size - 1) >> (m_vol->clusterSizeShift() + 9)) + 1 : 0;
+  return n <= keep || m_vol->bitmapPut(m_firstCluster + keep, n - keep, false);
+}
+//------------------------------------------------------------------------------
+// Return character k of the name being read at this directory's position.
+// Characters above 0X7E are returned as '?'.  Return -1 for an error.
+int16_t FatFile::exFatNameChar(uint8_t k) {
+  uint8_t i = k % EXFAT_NAME_DIM;
+  exfat_name_t* ne;
+  if (i == 0 && !readDirCache()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  // last entry read
+  ne = reinterpret_cast<exfat_name_t*>(m_vol->cacheAddress()->dir
+                                      + (((m_curPosition >> 5) - 1) & 0XF));
+  if (ne->entryType != EXFAT_TYPE_NAME) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  return ne->name[i] > 0X7E ? '?' : ne->name[i];
+
+fail:
+  return -1;
+}
+//------------------------------------------------------------------------------
+bool FatFile::exFatOpen(FatFile* dirFile, fname_t* fname, uint8_t oflag) {
+  uint8_t len = fname->len;
+  uint8_t freeNeed = 2 + (len + EXFAT_NAME_DIM - 1)/EXFAT_NAME_DIM;
+  uint8_t freeFound = 0;
+  uint16_t freeIndex = 0;
+  uint16_t curIndex;
+  uint16_t hash = 0;
+  uint8_t* p;
+
+  for (uint8_t i = 0; i < len; i++) {
+    hash = exFatSum(hash, exFatToUpper(fname->lfn[i]));
+    hash = exFatSum(hash, 0);
+  }
+  dirFile->rewind();
+  while (1) {
+    curIndex = dirFile->m_curPosition/32;
+    p = reinterpret_cast<uint8_t*>(dirFile->readDirCache(true));
+    if (!p) {
+      if (dirFile->getError()) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      // At EOF
+      goto create;
+    }
+    if (!(p[0] & EXFAT_TYPE_IN_USE)) {
+      if (freeFound == 0) {
+        freeIndex = curIndex;
+      }
+      if (freeFound < freeNeed) {
+        freeFound++;
+      }
+      if (p[0] == 0) {
+        goto create;
+      }
+      continue;
+    }
+    if (freeFound < freeNeed) {
+      freeFound = 0;
+    }
+    if (p[0] != EXFAT_TYPE_FILE) {
+      continue;
+    }
+    exfat_stream_t* se =
+      reinterpret_cast<exfat_stream_t*>(dirFile->readDirCache());
+    if (!se) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    if (se->entryType != EXFAT_TYPE_STREAM || se->nameLength != len
+        || se->nameHash != hash) {
+      continue;
+    }
+    uint8_t k;
+    for (k = 0; k < len; k++) {
+      int16_t c = dirFile->exFatNameChar(k);
+      if (c < 0) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      if (exFatToUpper(c) != exFatToUpper(fname->lfn[k])) {
+        break;
+      }
+    }
+    if (k == len) {
+      // don't open existing file if O_EXCL
+      if (oflag & O_EXCL) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      return exFatOpenSet(dirFile, curIndex, oflag);
+    }
+  }
+
+create:
+  // don't create unless O_CREAT and O_WRITE
+  if (!(oflag & O_CREAT) || !(oflag & O_WRITE)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  // If at EOF start in next cluster.
+  if (freeFound == 0) {
+    freeIndex = curIndex;
+  }
+  while (freeFound < freeNeed) {
+    p = reinterpret_cast<uint8_t*>(dirFile->readDirCache());
+    if (!p) {
+      if (dirFile->getError()) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      // EOF if no error.
+      break;
+    }
+    freeFound++;
+  }
+  while (freeFound < freeNeed) {
+    // The parent entry has the directory size.
+    if (!dirFile->addDirCluster() || !dirFile->sync()) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    // Done if more than one block per cluster.  Max freeNeed is 19.
+    if (dirFile->m_vol->blocksPerCluster() > 1) {
+      break;
+    }
+    freeFound += 16;
+  }
+  if (!dirFile->seekSet(32UL*freeIndex)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  for (uint8_t i = 0; i < freeNeed; i++) {
+    p = reinterpret_cast<uint8_t*>(dirFile->readDirCache());
+    if (!p) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    dirFile->m_vol->cacheDirty();
+    memset(p, 0, 32);
+    if (i == 0) {
+      exfat_file_t* fe = reinterpret_cast<exfat_file_t*>(p);
+      uint16_t date = FAT_DEFAULT_DATE;
+      uint16_t time = FAT_DEFAULT_TIME;
+      if (m_dateTime) {
+        // call user date/time function
+        m_dateTime(&date, &time);
+      }
+      fe->entryType = EXFAT_TYPE_FILE;
+      fe->secondaryCount = freeNeed - 1;
+      fe->attributes = DIR_ATT_ARCHIVE;
+      fe->createTimestamp = (uint32_t)date << 16 | time;
+      fe->modifyTimestamp = fe->createTimestamp;
+      fe->accessTimestamp = fe->createTimestamp;
+    } else if (i == 1) {
+      exfat_stream_t* se = reinterpret_cast<exfat_stream_t*>(p);
+      se->entryType = EXFAT_TYPE_STREAM;
+      se->flags = EXFAT_FLAG_ALLOCATION_POSSIBLE;
+      se->nameLength = len;
+      se->nameHash = hash;
+    } else {
+      exfat_name_t* ne = reinterpret_cast<exfat_name_t*>(p);
+      ne->entryType = EXFAT_TYPE_NAME;
+      for (uint8_t j = 0; j < EXFAT_NAME_DIM; j++) {
+        uint8_t k = EXFAT_NAME_DIM*(i - 2) + j;
+        if (k >= len) {
+          break;
+        }
+        ne->name[j] = fname->lfn[k];
+      }
+    }
+  }
+  if (!dirFile->exFatChecksumSet(freeIndex)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  return exFatOpenSet(dirFile, freeIndex, oflag);
+
+fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+// Open the entry set at index in dirFile.
+bool FatFile::exFatOpenSet(FatFile* dirFile, uint16_t index, uint8_t oflag) {
+  exfat_file_t* fe;
+  exfat_stream_t* se;
+
+  memset(this, 0, sizeof(FatFile));
+  m_vol = dirFile->m_vol;
+  m_dirIndex = index;
+  m_dirCluster = dirFile->m_firstCluster;
+  if (!dirFile->seekSet(32UL*index)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  fe = reinterpret_cast<exfat_file_t*>(dirFile->readDirCache());
+  if (!fe || fe->entryType != EXFAT_TYPE_FILE || fe->secondaryCount < 2) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  m_dirBlock = m_vol->cacheBlockNumber();
+  m_lfnOrd = fe->secondaryCount;
+  m_attr = fe->attributes & FILE_ATTR_COPY;
+  if (!isSubDir()) {
+    m_attr |= FILE_ATTR_FILE;
+  }
+  // Write, truncate, or at end is an error for a directory or read-only file.
+  if (oflag & (O_WRITE | O_TRUNC | O_AT_END)) {
+    if (isSubDir() || isReadOnly()) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+  }
+  se = reinterpret_cast<exfat_stream_t*>(dirFile->readDirCache());
+  if (!se || se->entryType != EXFAT_TYPE_STREAM) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  // Files are limited to 4 GB.
+  if (se->dataLength > 0XFFFFFFFF) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  // Space allocated past the valid data is only read.
+  if ((oflag & (O_WRITE | O_TRUNC)) &&
+      se->validDataLength != se->dataLength) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  // save open flags for read/write
+  m_flags = oflag & F_OFLAG;
+  if ((se->flags & EXFAT_FLAG_NO_FAT_CHAIN) && se->firstCluster) {
+    m_flags |= F_NO_FAT_CHAIN;
+  }
+  if (dirFile->m_flags & F_NO_FAT_CHAIN) {
+    m_flags |= F_DIR_NO_FAT_CHAIN;
+  }
+  m_firstCluster = se->firstCluster;
+  m_fileSize = se->validDataLength;
+
+  if (oflag & O_TRUNC) {
+    if (m_firstCluster && !exFatFree(0, m_fileSize)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    m_firstCluster = 0;
+    m_fileSize = 0;
+    m_flags &= ~F_NO_FAT_CHAIN;
+    // need to update directory entry
+    m_flags |= F_FILE_DIR_DIRTY;
+  }
+  if ((oflag & O_AT_END) && !seekSet(m_fileSize)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  return true;
+
+fail:
+  m_attr = FILE_ATTR_CLOSED;
+  return false;
+}
+//------------------------------------------------------------------------------
+// Open the directory of this file at the file's entry set.  Copy the
+// timestamps to dir if it isn't null.  Return the name length with
+// dirFile before the first name entry, or -1 for an error.
+int16_t FatFile::exFatReadSet(FatFile* dirFile, dir_t* dir) {
+  exfat_file_t* fe;
+  exfat_stream_t* se;
+  if (!dirFile->openCluster(this) || !dirFile->seekSet(32UL*m_dirIndex)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  fe = reinterpret_cast<exfat_file_t*>(dirFile->readDirCache());
+  if (!fe || fe->entryType != EXFAT_TYPE_FILE) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  if (dir) {
+    dir->creationTimeTenths = fe->create10ms;
+    dir->creationTime = fe->createTimestamp;
+    dir->creationDate = fe->createTimestamp >> 16;
+    dir->lastAccessDate = fe->accessTimestamp >> 16;
+    dir->lastWriteTime = fe->modifyTimestamp;
+    dir->lastWriteDate = fe->modifyTimestamp >> 16;
+  }
+  se = reinterpret_cast<exfat_stream_t*>(dirFile->readDirCache());
+  if (!se || se->entryType != EXFAT_TYPE_STREAM) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  return se->nameLength;
+
+fail:
+  return -1;
+}
+//------------------------------------------------------------------------------
+bool FatFile::exFatRemove() {
+  FatFile dirFile;
+  uint8_t count = 0;
+  if (!dirFile.openCluster(this) || !dirFile.seekSet(32UL*m_dirIndex)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  // Mark the entries of the set not in use.
+  for (uint8_t i = 0; i <= count; i++) {
+    uint8_t* p = reinterpret_cast<uint8_t*>(dirFile.readDirCache());
+    if (!p) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    if (i == 0) {
+      // check for deleted by another open file object
+      if (p[0] != EXFAT_TYPE_FILE) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      count = p[1];
+    }
+    p[0] &= ~EXFAT_TYPE_IN_USE;
+    m_vol->cacheDirty();
+  }
+  // Set this file closed.
+  m_attr = FILE_ATTR_CLOSED;
+
+  // Free any clusters.
+  if (m_firstCluster && !exFatFree(0, m_fileSize)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  return m_vol->cacheSync();
+
+fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+// Write the first cluster, size, and modify time to the entry set.
+bool FatFile::exFatSyncEntry() {
+  FatFile dirFile;
+  exfat_file_t* fe;
+  exfat_stream_t* se;
+  // root has no entry
+  if (isRoot()) {
+    goto done;
+  }
+  if (!dirFile.openCluster(this) || !dirFile.seekSet(32UL*m_dirIndex)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  fe = reinterpret_cast<exfat_file_t*>(dirFile.readDirCache());
+  // check for deleted by another open file object
+  if (!fe || fe->entryType != EXFAT_TYPE_FILE) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  // set modify time if user supplied a callback date/time function
+  if (m_dateTime) {
+    uint16_t date;
+    uint16_t time;
+    m_dateTime(&date, &time);
+    fe->modifyTimestamp = (uint32_t)date << 16 | time;
+    fe->accessTimestamp = fe->modifyTimestamp;
+    fe->modify10ms = 0;
+    m_vol->cacheDirty();
+  }
+  se = reinterpret_cast<exfat_stream_t*>(dirFile.readDirCache());
+  if (!se || se->entryType != EXFAT_TYPE_STREAM) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  se->flags = EXFAT_FLAG_ALLOCATION_POSSIBLE;
+  if (m_flags & F_NO_FAT_CHAIN) {
+    se->flags |= EXFAT_FLAG_NO_FAT_CHAIN;
+  }
+  se->firstCluster = m_firstCluster;
+  se->validDataLength = m_fileSize;
+  se->dataLength = m_fileSize;
+  m_vol->cacheDirty();
+  if (!dirFile.exFatChecksumSet(m_dirIndex)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+
+done:
+  m_flags &= ~F_FILE_DIR_DIRTY;
+  return true;
+
+fail:
+  return false;
+}
+#endif  // ENABLE_EXFAT
@@ -27,6 +27,26 @@ uint8_t FatFile::lfnChecksum(uint8_t* name) {
   }
   return sum;
 }
+#if DIR_INDEX_SIZE
+//------------------------------------------------------------------------------
+// Index value for a short name.  Values 0 and 1 are reserved.
+uint8_t FatFile::dirIndexHash(uint8_t* name) {
+  uint8_t sum = lfnChecksum(name);
+  return sum < 2 ? sum + 2 : sum;
+}
+//------------------------------------------------------------------------------
+// Index value for a directory entry.  Zero for a deleted entry, one for an
+// entry that a short name can't match.
+uint8_t FatFile::dirIndexValue(dir_t* dir) {
+  if (dir->name[0] == DIR_NAME_DELETED) {
+    return 0;
+  }
+  if (!DIR_IS_FILE_OR_SUBDIR(dir) || dir->name[0] == '.') {
+    return 1;
+  }
+  return dirIndexHash(dir->name);
+}
+#endif  // DIR_INDEX_SIZE
 #if USE_LONG_FILE_NAMES
 //------------------------------------------------------------------------------
 // Saves about 90 bytes of flash on 328 over tolower().
@@ -124,6 +144,26 @@ bool FatFile::getName(char* name, size_t size) {
   if (!isLFN()) {
     return getSFN(name);
   }
+#if ENABLE_EXFAT
+  if (m_vol->isExFat()) {
+    int16_t len = exFatReadSet(&dirFile, 0);
+    if (len < 0) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    uint8_t k;
+    for (k = 0; k < len && k < size - 1; k++) {
+      int16_t c = dirFile.exFatNameChar(k);
+      if (c < 0) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      name[k] = c;
+    }
+    name[k] = 0;
+    return true;
+  }
+#endif  // ENABLE_EXFAT
   if (!dirFile.openCluster(this)) {
     DBG_FAIL_MACRO;
     goto fail;
@@ -171,6 +211,13 @@ bool FatFile::openCluster(FatFile* file) {
   m_flags = O_READ;
   m_vol = file->m_vol;
   m_firstCluster = file->m_dirCluster;
+#if ENABLE_EXFAT
+  if (file->m_flags & F_DIR_NO_FAT_CHAIN) {
+    // The size isn't known, only entries of open files are read.
+    m_flags |= F_NO_FAT_CHAIN;
+    m_fileSize = 0XFFFFFFFF;
+  }
+#endif  // ENABLE_EXFAT
   return true;
 }
 //------------------------------------------------------------------------------
@@ -297,15 +344,80 @@ bool FatFile::open(FatFile* dirFile, fname_t* fname, uint8_t oflag) {
   dir_t* dir;
   ldir_t* ldir;
   size_t len = fname->len;
+#if DIR_INDEX_SIZE
+  FatVolume* vol = dirFile->m_vol;
+  bool indexed;
+  uint8_t hash;
+#endif  // DIR_INDEX_SIZE
 
   if (!dirFile->isDir() || isOpen()) {
     DBG_FAIL_MACRO;
     goto fail;
   }
+#if ENABLE_EXFAT
+  if (dirFile->m_vol->isExFat()) {
+    return exFatOpen(dirFile, fname, oflag);
+  }
+#endif  // ENABLE_EXFAT
   // Number of directory entries needed.
   freeNeed = fname->flags & FNAME_FLAG_NEED_LFN ? 1 + (len + 12)/13 : 1;
 
+#if DIR_INDEX_SIZE
+  if (vol->m_dirIndexCluster != dirFile->m_firstCluster
+      && !(fname->flags & FNAME_FLAG_NEED_LFN)) {
+    // start index for this directory
+    vol->m_dirIndexCluster = dirFile->m_firstCluster;
+    vol->m_dirIndexCount = 0;
+  }
+  indexed = vol->m_dirIndexCluster == dirFile->m_firstCluster;
+  curIndex = 0;
+  if (indexed && !(fname->flags & FNAME_FLAG_NEED_LFN)) {
+    // only read entries with a matching checksum
+    hash = dirIndexHash(fname->sfn);
+    for (; curIndex < vol->m_dirIndexCount; curIndex++) {
+      if (vol->m_dirIndex[curIndex] == 0 && freeFound == 0) {
+        freeIndex = curIndex;
+        freeFound = 1;
+      }
+      if (vol->m_dirIndex[curIndex] != hash) {
+        continue;
+      }
+      if (!dirFile->seekSet(32UL*(curIndex ? curIndex - 1 : 0))) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      if (curIndex) {
+        dir = dirFile->readDirCache();
+        if (!dir) {
+          DBG_FAIL_MACRO;
+          goto fail;
+        }
+        if (DIR_IS_LONG_NAME(dir) && dir->name[0] != DIR_NAME_DELETED) {
+          // may have a matching long name, use full search
+          freeFound = 0;
+          curIndex = 0;
+          break;
+        }
+      }
+      dir = dirFile->readDirCache();
+      if (!dir) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      if (DIR_IS_FILE_OR_SUBDIR(dir)
+          && !memcmp(dir->name, fname->sfn, sizeof(fname->sfn))) {
+        goto found;
+      }
+    }
+  }
+  // search from first block not indexed
+  if (!dirFile->seekSet(32UL*(curIndex & ~0XF))) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+#else  // DIR_INDEX_SIZE
   dirFile->rewind();
+#endif  // DIR_INDEX_SIZE
   while (1) {
     curIndex = dirFile->m_curPosition/32;
     dir = dirFile->readDirCache(true);
@@ -317,6 +429,11 @@ bool FatFile::open(FatFile* dirFile, fname_t* fname, uint8_t oflag) {
       // At EOF
       goto create;
     }
+#if DIR_INDEX_SIZE
+    if (indexed && dir->name[0] != DIR_NAME_FREE) {
+      vol->dirIndexPut(curIndex, dirIndexValue(dir));
+    }
+#endif  // DIR_INDEX_SIZE
     if (dir->name[0] == DIR_NAME_DELETED || dir->name[0] == DIR_NAME_FREE) {
       if (freeFound == 0) {
         freeIndex = curIndex;
@@ -463,6 +580,14 @@ create:
   // initialize as empty file
   memset(dir, 0, sizeof(dir_t));
   memcpy(dir->name, fname->sfn, 11);
+#if DIR_INDEX_SIZE
+  if (indexed) {
+    for (uint16_t i = freeIndex; i < curIndex; i++) {
+      vol->dirIndexPut(i, 1);
+    }
+    vol->dirIndexPut(curIndex, dirIndexValue(dir));
+  }
+#endif  // DIR_INDEX_SIZE
 
   // Set base-name and extension lower case bits.
   dir->reservedNT =  (DIR_NT_LC_BASE | DIR_NT_LC_EXT) & fname->flags;
@@ -504,6 +629,25 @@ size_t FatFile::printName(print_t* pr) {
   if (!isLFN()) {
     return printSFN(pr);
   }
+#if ENABLE_EXFAT
+  if (m_vol->isExFat()) {
+    int16_t len = exFatReadSet(&dirFile, 0);
+    if (len < 0) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    for (uint8_t k = 0; k < len; k++) {
+      int16_t c = dirFile.exFatNameChar(k);
+      if (c < 0) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      pr->write(static_cast<char>(c));
+      n++;
+    }
+    return n;
+  }
+#endif  // ENABLE_EXFAT
   if (!dirFile.openCluster(this)) {
     DBG_FAIL_MACRO;
     goto fail;
@@ -559,6 +703,11 @@ bool FatFile::remove() {
     DBG_FAIL_MACRO;
     goto fail;
   }
+#if ENABLE_EXFAT
+  if (m_vol->isExFat()) {
+    return exFatRemove();
+  }
+#endif  // ENABLE_EXFAT
   // Free any clusters.
   if (m_firstCluster && !m_vol->freeChain(m_firstCluster)) {
     DBG_FAIL_MACRO;
@@ -574,6 +723,15 @@ bool FatFile::remove() {
 
   // Mark entry deleted.
   dir->name[0] = DIR_NAME_DELETED;
+#if DIR_INDEX_SIZE
+  if (m_vol->m_dirIndexCluster == m_dirCluster) {
+    m_vol->dirIndexPut(m_dirIndex, 0);
+  }
+  if (m_firstCluster && m_vol->m_dirIndexCluster == m_firstCluster) {
+    // removed directory was indexed
+    m_vol->m_dirIndexCount = 0;
+  }
+#endif  // DIR_INDEX_SIZE
 
   // Set this file closed.
   m_attr = FILE_ATTR_CLOSED;
@@ -31,6 +31,18 @@ bool FatFile::getSFN(char* name) {
     name[1] = '\0';
     return true;
   }
+#if ENABLE_EXFAT
+  if (m_vol->isExFat()) {
+    // 8.3 name made from the exFAT name
+    dir_t entry;
+    if (!exFatDirEntry(&entry)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    dirName(&entry, name);
+    return true;
+  }
+#endif  // ENABLE_EXFAT
   // cache entry
   dir = cacheDirEntry(FatCache::CACHE_FOR_READ);
   if (!dir) {
@@ -260,6 +272,11 @@ bool FatFile::remove() {
   }
   // Mark entry deleted.
   dir->name[0] = DIR_NAME_DELETED;
+#if DIR_INDEX_SIZE
+  if (m_vol->m_dirIndexCluster == m_dirCluster) {
+    m_vol->dirIndexPut(m_dirIndex, 0);
+  }
+#endif  // DIR_INDEX_SIZE
 
   // Set this file closed.
   m_attr = FILE_ATTR_CLOSED;
@@ -79,6 +79,18 @@
 #endif  // __arm__
 #endif  // USE_SEPARATE_FAT_CACHE
 //------------------------------------------------------------------------------
+/**
+ * Set FAT_CACHE_BLOCKS greater than one to use a shared least recently used
+ * cache of FAT_CACHE_BLOCKS blocks in place of USE_SEPARATE_FAT_CACHE.
+ */
+#ifndef FAT_CACHE_BLOCKS
+#ifdef __arm__
+#define FAT_CACHE_BLOCKS 4
+#else  // __arm__
+#define FAT_CACHE_BLOCKS 1
+#endif  // __arm__
+#endif  // FAT_CACHE_BLOCKS
+//------------------------------------------------------------------------------
 /**
  * Set USE_MULTI_BLOCK_IO non-zero to use multi-block SD read/write.
  *
@@ -92,6 +104,14 @@
 #endif  // RAMEND
 #endif  // USE_MULTI_BLOCK_IO
 //------------------------------------------------------------------------------
+/**
+ * Set USE_FAT_SCAN_STREAM nonzero to read the FAT with one multiple block
+ * read when counting free clusters and searching for free clusters.
+ */
+#ifndef USE_FAT_SCAN_STREAM
+#define USE_FAT_SCAN_STREAM 1
+#endif  // USE_FAT_SCAN_STREAM
+//------------------------------------------------------------------------------
 /**
  * Set DESTRUCTOR_CLOSES_FILE non-zero to close a file in its destructor.
  *
@@ -101,6 +121,57 @@
 #define DESTRUCTOR_CLOSES_FILE 0
 #endif  // DESTRUCTOR_CLOSES_FILE
 //------------------------------------------------------------------------------
+/**
+ * Set FAT_FREE_SUMMARY_SIZE non-zero to keep a bitmap, FAT_FREE_SUMMARY_SIZE
+ * bytes long, of FAT regions that may have free clusters.  Allocation skips
+ * regions known to be full.
+ */
+#ifndef FAT_FREE_SUMMARY_SIZE
+#define FAT_FREE_SUMMARY_SIZE 16
+#endif  // FAT_FREE_SUMMARY_SIZE
+//------------------------------------------------------------------------------
+/**
+ * Set DEFER_FAT_MIRROR non-zero to copy changed FAT blocks to the second FAT
+ * at cache sync rather than at every FAT block write.
+ */
+#ifndef DEFER_FAT_MIRROR
+#define DEFER_FAT_MIRROR 1
+#endif  // DEFER_FAT_MIRROR
+//------------------------------------------------------------------------------
+/**
+ * Set FILE_EXTENT_MAP_SIZE non-zero to map up to FILE_EXTENT_MAP_SIZE runs of
+ * contiguous clusters in each file so seekSet() can skip FAT reads.
+ */
+#ifndef FILE_EXTENT_MAP_SIZE
+#ifdef __arm__
+#define FILE_EXTENT_MAP_SIZE 4
+#else  // __arm__
+#define FILE_EXTENT_MAP_SIZE 1
+#endif  // __arm__
+#endif  // FILE_EXTENT_MAP_SIZE
+//------------------------------------------------------------------------------
+/**
+ * Set DIR_INDEX_SIZE non-zero to keep a short name checksum for the first
+ * DIR_INDEX_SIZE entries of the last directory searched by open().
+ */
+#ifndef DIR_INDEX_SIZE
+#ifdef __arm__
+#define DIR_INDEX_SIZE 1024
+#else  // __arm__
+#define DIR_INDEX_SIZE 0
+#endif  // __arm__
+#endif  // DIR_INDEX_SIZE
+//------------------------------------------------------------------------------
+/**
+ * Set ENABLE_EXFAT non-zero to mount exFAT volumes.
+ */
+#ifndef ENABLE_EXFAT
+#define ENABLE_EXFAT 1
+#endif  // ENABLE_EXFAT
+#if ENABLE_EXFAT && !USE_LONG_FILE_NAMES
+#error ENABLE_EXFAT requires USE_LONG_FILE_NAMES
+#endif  // ENABLE_EXFAT && !USE_LONG_FILE_NAMES
+//------------------------------------------------------------------------------
 /**
  * Call flush for endl if ENDL_CALLS_FLUSH is non-zero
  *
@@ -752,4 +752,201 @@ typedef struct longDirectoryEntry ldir_t;
  * begin with an entry having this mask.
  */
 const uint8_t LDIR_ORD_LAST_LONG_ENTRY = 0X40;
+//------------------------------------------------------------------------------
+// exFAT structures, from the Microsoft exFAT File System Specification
+/**
+ * \struct exfat_boot
+ * \brief Boot sector for an exFAT volume.
+ */
+struct exfat_boot {
+  /** X86 jump, 0XEB 0X76 0X90. */
+  uint8_t  jump[3];
+  /** Must be "EXFAT   ". */
+  char     oemName[8];
+  /** Must be zero, this is where a FAT boot sector has its BPB. */
+  uint8_t  mustBeZero[53];
+  /** Media relative block number of the volume. */
+  uint64_t partitionOffset;
+  /** Size of the volume in blocks. */
+  uint64_t volumeLength;
+  /** Volume relative block number of the first FAT. */
+  uint32_t fatOffset;
+  /** Size of each FAT in blocks. */
+  uint32_t fatLength;
+  /** Volume relative block number of cluster two. */
+  uint32_t clusterHeapOffset;
+  /** Number of clusters in the cluster heap. */
+  uint32_t clusterCount;
+  /** First cluster of the root directory. */
+  uint32_t rootDirectoryCluster;
+  /** Volume serial number. */
+  uint32_t volumeSerialNumber;
+  /** File system revision, 0X0100 for 1.00. */
+  uint16_t fileSystemRevision;
+  /** Bit 0 active FAT, bit 1 volume dirty, bit 2 media failure. */
+  uint16_t volumeFlags;
+  /** Log2 of the sector size, 9 for 512 byte sectors. */
+  uint8_t  bytesPerSectorShift;
+  /** Log2 of the cluster size in sectors. */
+  uint8_t  sectorsPerClusterShift;
+  /** Number of FATs, two only for TexFAT. */
+  uint8_t  numberOfFats;
+  /** INT 13h drive number. */
+  uint8_t  driveSelect;
+  /** Percent of the cluster heap in use or 0XFF if not known. */
+  uint8_t  percentInUse;
+  /** Reserved. */
+  uint8_t  reserved[7];
+  /** Boot code. */
+  uint8_t  bootCode[390];
+  /** must be 0X55, 0XAA */
+  uint8_t  bootSignature[2];
+} __attribute__((packed));
+/** Type name for exFAT boot sector */
+typedef struct exfat_boot exfat_boot_t;
+//------------------------------------------------------------------------------
+/** exFAT allocation bitmap directory entry type. */
+uint8_t const EXFAT_TYPE_BITMAP = 0X81;
+/** exFAT up-case table directory entry type. */
+uint8_t const EXFAT_TYPE_UPCASE = 0X82;
+/** exFAT volume label directory entry type. */
+uint8_t const EXFAT_TYPE_LABEL = 0X83;
+/** exFAT file directory entry type, first entry of a file's entry set. */
+uint8_t const EXFAT_TYPE_FILE = 0X85;
+/** exFAT stream extension directory entry type. */
+uint8_t const EXFAT_TYPE_STREAM = 0XC0;
+/** exFAT file name directory entry type. */
+uint8_t const EXFAT_TYPE_NAME = 0XC1;
+/** Entry type bit, clear for a deleted entry. Type zero ends a directory. */
+uint8_t const EXFAT_TYPE_IN_USE = 0X80;
+/** Stream extension flag, set if the file may have clusters. */
+uint8_t const EXFAT_FLAG_ALLOCATION_POSSIBLE = 0X01;
+/** Stream extension flag, set if the clusters are contiguous and not in
+ *  the FAT. */
+uint8_t const EXFAT_FLAG_NO_FAT_CHAIN = 0X02;
+/** Characters in an exFAT file name entry. */
+uint8_t const EXFAT_NAME_DIM = 15;
+/** exFAT end of chain value. */
+uint32_t const EXFAT_EOC = 0XFFFFFFFF;
+/**
+ * \struct exfat_file
+ * \brief exFAT file directory entry, the first entry of a file's entry set.
+ *
+ * Timestamps hold a FAT date in the high 16 bits and a FAT time in the
+ * low 16 bits.
+ */
+struct exfat_file {
+  /** EXFAT_TYPE_FILE */
+  uint8_t  entryType;
+  /** Number of entries that follow, the stream extension and names. */
+  uint8_t  secondaryCount;
+  /** Checksum of the entry set, this field excluded. */
+  uint16_t setChecksum;
+  /** Attributes, same bits as a FAT entry. */
+  uint16_t attributes;
+  /** Reserved. */
+  uint16_t reserved1;
+  /** Date and time the file was created. */
+  uint32_t createTimestamp;
+  /** Date and time of the last write. */
+  uint32_t modifyTimestamp;
+  /** Date and time of the last access. */
+  uint32_t accessTimestamp;
+  /** 10 ms units to add to createTimestamp, 0-199. */
+  uint8_t  create10ms;
+  /** 10 ms units to add to modifyTimestamp, 0-199. */
+  uint8_t  modify10ms;
+  /** UTC offset of createTimestamp, bit 7 set if valid. */
+  uint8_t  createUtcOffset;
+  /** UTC offset of modifyTimestamp, bit 7 set if valid. */
+  uint8_t  modifyUtcOffset;
+  /** UTC offset of accessTimestamp, bit 7 set if valid. */
+  uint8_t  accessUtcOffset;
+  /** Reserved. */
+  uint8_t  reserved2[7];
+} __attribute__((packed));
+/** Type name for exFAT file directory entry */
+typedef struct exfat_file exfat_file_t;
+/**
+ * \struct exfat_stream
+ * \brief exFAT stream extension directory entry, second entry of a set.
+ */
+struct exfat_stream {
+  /** EXFAT_TYPE_STREAM */
+  uint8_t  entryType;
+  /** EXFAT_FLAG_ALLOCATION_POSSIBLE and EXFAT_FLAG_NO_FAT_CHAIN. */
+  uint8_t  flags;
+  /** Reserved. */
+  uint8_t  reserved1;
+  /** Name length in characters. */
+  uint8_t  nameLength;
+  /** Hash of the up-cased name. */
+  uint16_t nameHash;
+  /** Reserved. */
+  uint16_t reserved2;
+  /** Bytes written, the file size. */
+  uint64_t validDataLength;
+  /** Reserved. */
+  uint32_t reserved3;
+  /** First cluster, zero if none. */
+  uint32_t firstCluster;
+  /** Bytes allocated, at least validDataLength. */
+  uint64_t dataLength;
+} __attribute__((packed));
+/** Type name for exFAT stream extension directory entry */
+typedef struct exfat_stream exfat_stream_t;
+/**
+ * \struct exfat_name
+ * \brief exFAT file name directory entry, up to 15 UTF-16 characters.
+ */
+struct exfat_name {
+  /** EXFAT_TYPE_NAME */
+  uint8_t  entryType;
+  /** Must be zero. */
+  uint8_t  flags;
+  /** Name characters, zero filled after the end of the name. */
+  uint16_t name[EXFAT_NAME_DIM];
+} __attribute__((packed));
+/** Type name for exFAT file name directory entry */
+typedef struct exfat_name exfat_name_t;
+/**
+ * \struct exfat_bitmap
+ * \brief exFAT allocation bitmap directory entry, in the root directory.
+ *
+ * Bit n of the bitmap is set if cluster n + 2 is in use.
+ */
+struct exfat_bitmap {
+  /** EXFAT_TYPE_BITMAP */
+  uint8_t  entryType;
+  /** Bit 0 zero for the first FAT's bitmap. */
+  uint8_t  flags;
+  /** Reserved. */
+  uint8_t  reserved[18];
+  /** First cluster of the bitmap. */
+  uint32_t firstCluster;
+  /** Size of the bitmap in bytes. */
+  uint64_t dataLength;
+} __attribute__((packed));
+/** Type name for exFAT allocation bitmap directory entry */
+typedef struct exfat_bitmap exfat_bitmap_t;
+/**
+ * \struct exfat_upcase
+ * \brief exFAT up-case table directory entry, in the root directory.
+ */
+struct exfat_upcase {
+  /** EXFAT_TYPE_UPCASE */
+  uint8_t  entryType;
+  /** Reserved. */
+  uint8_t  reserved1[3];
+  /** Checksum of the table. */
+  uint32_t tableChecksum;
+  /** Reserved. */
+  uint8_t  reserved2[12];
+  /** First cluster of the table. */
+  uint32_t firstCluster;
+  /** Size of the table in bytes. */
+  uint64_t dataLength;
+} __attribute__((packed));
+/** Type name for exFAT up-case table directory entry */
+typedef struct exfat_upcase exfat_upcase_t;
 #endif  // FatStructs_h
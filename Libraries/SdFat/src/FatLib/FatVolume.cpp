@@ -48,8 +48,13 @@ bool FatCache::sync() {
       DBG_FAIL_MACRO;
       goto fail;
     }
-    // mirror second FAT
-    if (m_status & CACHE_STATUS_MIRROR_FAT) {
+    // mirror second FAT, exFAT has one FAT
+#if DEFER_FAT_MIRROR
+    if ((m_status & CACHE_STATUS_MIRROR_FAT) && m_vol->fatCount() > 1
+        && !m_vol->mirrorDefer(m_lbn)) {
+#else  // DEFER_FAT_MIRROR
+    if ((m_status & CACHE_STATUS_MIRROR_FAT) && m_vol->fatCount() > 1) {
+#endif  // DEFER_FAT_MIRROR
       uint32_t lbn = m_lbn + m_vol->blocksPerFat();
       if (!m_vol->writeBlock(lbn, m_block.data)) {
         DBG_FAIL_MACRO;
@@ -63,31 +68,109 @@ bool FatCache::sync() {
 fail:
   return false;
 }
+#if FAT_CACHE_BLOCKS > 1
 //------------------------------------------------------------------------------
-bool FatVolume::allocateCluster(uint32_t current, uint32_t* next) {
-  uint32_t find = current ? current : m_allocSearchStart;
-  uint32_t start = find;
-  while (1) {
-    find++;
-    // If at end of FAT go to beginning of FAT.
-    if (find > m_lastCluster) {
-      find = 2;
-    }
-    uint32_t f;
-    int8_t fg = fatGet(find, &f);
-    if (fg < 0) {
-      DBG_FAIL_MACRO;
-      goto fail;
+cache_t* FatVolume::cacheFetchData(uint32_t blockNumber, uint8_t options) {
+  // Use the least recently used entry if the block is not cached.
+  uint8_t i = 0;
+  while (i < (FAT_CACHE_BLOCKS - 1)
+         && m_cache[m_cacheLru[i]].lbn() != blockNumber) {
+    i++;
+  }
+  uint8_t entry = m_cacheLru[i];
+  // make entry most recently used
+  for (; i > 0; i--) {
+    m_cacheLru[i] = m_cacheLru[i - 1];
+  }
+  m_cacheLru[0] = entry;
+  return m_cache[entry].read(blockNumber, options);
+}
+//------------------------------------------------------------------------------
+void FatVolume::cacheInit() {
+  for (uint8_t i = 0; i < FAT_CACHE_BLOCKS; i++) {
+    m_cache[i].init(this);
+    m_cacheLru[i] = i;
+  }
+}
+//------------------------------------------------------------------------------
+bool FatVolume::cacheInRange(uint32_t lbn, uint16_t count) {
+  for (uint8_t i = 0; i < FAT_CACHE_BLOCKS; i++) {
+    if (lbn <= m_cache[i].lbn() && m_cache[i].lbn() - lbn < count) {
+      return true;
     }
-    if (fg && f == 0) {
-      break;
+  }
+  return false;
+}
+//------------------------------------------------------------------------------
+void FatVolume::cacheInvalidate() {
+  for (uint8_t i = 0; i < FAT_CACHE_BLOCKS; i++) {
+    m_cache[i].invalidate();
+  }
+}
+//------------------------------------------------------------------------------
+void FatVolume::cacheInvalidateRange(uint32_t lbn, uint16_t count) {
+  for (uint8_t i = 0; i < FAT_CACHE_BLOCKS; i++) {
+    if (lbn <= m_cache[i].lbn() && m_cache[i].lbn() - lbn < count) {
+      m_cache[i].invalidate();
     }
-    if (find == start) {
-      // Can't find space checked all clusters.
+  }
+}
+//------------------------------------------------------------------------------
+bool FatVolume::cacheSync() {
+  for (uint8_t i = 0; i < FAT_CACHE_BLOCKS; i++) {
+    if (!m_cache[i].sync()) {
       DBG_FAIL_MACRO;
       goto fail;
     }
   }
+  return mirrorSync() && fsInfoSync() && syncBlocks();
+
+fail:
+  return false;
+}
+#endif  // FAT_CACHE_BLOCKS > 1
+#if USE_FAT_SCAN_STREAM
+//------------------------------------------------------------------------------
+// Write dirty cache blocks so the device has the current FAT, then free a
+// cache buffer to stream FAT blocks into.  Unlike cacheSync() this doesn't
+// write FSINFO or a deferred FAT mirror.
+cache_t* FatVolume::cacheScanBuffer() {
+#if FAT_CACHE_BLOCKS > 1
+  for (uint8_t i = 0; i < FAT_CACHE_BLOCKS; i++) {
+    if (!m_cache[i].sync()) {
+      return 0;
+    }
+  }
+  // Keep the more recently used blocks.
+  FatCache* fc = &m_cache[m_cacheLru[FAT_CACHE_BLOCKS - 1]];
+#elif USE_SEPARATE_FAT_CACHE
+  FatCache* fc = &m_fatCache;
+#else  // FAT_CACHE_BLOCKS > 1
+  FatCache* fc = &m_cache;
+#endif  // FAT_CACHE_BLOCKS > 1
+  if (!fc->sync()) {
+    return 0;
+  }
+  fc->invalidate();
+  return fc->block();
+}
+#endif  // USE_FAT_SCAN_STREAM
+//------------------------------------------------------------------------------
+bool FatVolume::allocateCluster(uint32_t current, uint32_t* next) {
+  uint32_t start = current ? current : m_allocSearchStart;
+  uint32_t find;
+  int8_t fr;
+  fsInfoChanged();
+  // Search after start to the end of the FAT, then wrap to its beginning.
+  fr = freeRun(start + 1, m_lastCluster, 1, &find);
+  if (fr == 0) {
+    fr = freeRun(2, start < m_lastCluster ? start : m_lastCluster, 1, &find);
+  }
+  if (fr <= 0) {
+    // Error or can't find space checked all clusters.
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
   // mark end of chain
   if (!fatPutEOC(find)) {
     DBG_FAIL_MACRO;
@@ -107,57 +190,94 @@ bool FatVolume::allocateCluster(uint32_t current, uint32_t* next) {
   *next = find;
   return true;
 
+fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+// Allocate up to count clusters for a growing file.  Use the clusters after
+// current if they are free, else the first run of count free clusters, else
+// the first free cluster and the free clusters that follow it.
+bool FatVolume::allocExtent(uint32_t current, uint16_t count,
+                            uint32_t* next) {
+  uint32_t last;
+  uint32_t f;
+  int8_t fg;
+  bool adjacent = false;
+  if (current && current < m_lastCluster) {
+    fg = fatGet(current + 1, &f);
+    if (fg < 0) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    adjacent = fg && f == 0;
+  }
+  if (!adjacent && count < m_extentFail) {
+    if (allocContiguous(count, next)) {
+      return !current || fatPut(current, *next);
+    }
+    // Don't search for a run this long until clusters are freed.
+    m_extentFail = count;
+  }
+  if (!allocateCluster(current, next)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  last = *next;
+  while (--count && last < m_lastCluster) {
+    fg = fatGet(last + 1, &f);
+    if (fg < 0) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    if (fg == 0 || f) {
+      break;
+    }
+    // mark end of chain then link
+    if (!fatPutEOC(last + 1) || !fatPut(last, last + 1)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    last++;
+    updateFreeClusterCount(-1);
+  }
+  if (m_allocSearchStart == *next) {
+    m_allocSearchStart = last;
+  }
+  return true;
+
 fail:
   return false;
 }
 //------------------------------------------------------------------------------
 // find a contiguous group of clusters
 bool FatVolume::allocContiguous(uint32_t count, uint32_t* firstCluster) {
-  // flag to save place to start next search
-  bool setStart = true;
   // start of group
   uint32_t bgnCluster;
   // end of group
   uint32_t endCluster;
   // Start at cluster after last allocated cluster.
   uint32_t startCluster = m_allocSearchStart;
-  endCluster = bgnCluster = startCluster + 1;
+  int8_t fr;
 
-  // search the FAT for free clusters
-  while (1) {
-    // If past end - start from beginning of FAT.
-    if (endCluster > m_lastCluster) {
-      bgnCluster = endCluster = 2;
-    }
-    uint32_t f;
-    int8_t fg = fatGet(endCluster, &f);
-    if (fg < 0) {
-      DBG_FAIL_MACRO;
-      goto fail;
-    }
-    if (f || fg == 0) {
-      // cluster in use try next cluster as bgnCluster
-      bgnCluster = endCluster + 1;
+  fsInfoChanged();
 
-      // don't update search start if unallocated clusters before endCluster.
-      if (bgnCluster != endCluster) {
-        setStart = false;
-      }
-    } else if ((endCluster - bgnCluster + 1) == count) {
-      // done - found space
-      break;
+  // A group can't wrap, search to the end of the FAT then from its start.
+  fr = freeRun(startCluster + 1, m_lastCluster, count, &bgnCluster);
+  if (fr > 0) {
+    if (bgnCluster == startCluster + 1) {
+      // No free clusters were skipped, remember possible next free cluster.
+      m_allocSearchStart = bgnCluster + count;
     }
-    // Can't find space if all clusters checked.
-    if (startCluster == endCluster) {
-      DBG_FAIL_MACRO;
-      goto fail;
-    }
-    endCluster++;
+  } else if (fr == 0) {
+    fr = freeRun(2, startCluster < m_lastCluster ? startCluster : m_lastCluster,
+                 count, &bgnCluster);
   }
-  // remember possible next free cluster
-  if (setStart) {
-    m_allocSearchStart = endCluster + 1;
+  if (fr <= 0) {
+    // Error or can't find space if all clusters checked.
+    DBG_FAIL_MACRO;
+    goto fail;
   }
+  endCluster = bgnCluster + count - 1;
 
   // mark end of chain
   if (!fatPutEOC(endCluster)) {
@@ -187,6 +307,181 @@ uint32_t FatVolume::clusterStartBlock(uint32_t cluster) const {
   return m_dataStartBlock + ((cluster - 2) << m_clusterSizeShift);
 }
 //------------------------------------------------------------------------------
+// Erase up to count free clusters starting at cluster.  Stops at the first
+// cluster in use so file data is never erased.
+bool FatVolume::eraseFree(uint32_t cluster, uint32_t count) {
+  uint32_t last = cluster - 1;
+  int8_t free;
+  while (count-- && last < m_lastCluster) {
+    free = isFree(last + 1);
+    if (free < 0) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    if (!free) {
+      break;
+    }
+    last++;
+  }
+  if (last < cluster) {
+    // no free cluster to erase
+    return true;
+  }
+  return eraseBlocks(clusterStartBlock(cluster),
+                     clusterStartBlock(last) + m_blocksPerCluster - 1);
+
+fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+// Return 1 if cluster is free, 0 if it is in use, -1 for an error.
+int8_t FatVolume::isFree(uint32_t cluster) {
+  uint32_t f;
+  int8_t fg;
+#if ENABLE_EXFAT
+  if (m_fatType == 64) {
+    cluster -= 2;
+    cache_t* pc = cacheFetchData(m_bitmapStart + (cluster >> 12),
+                                 FatCache::CACHE_FOR_READ);
+    if (!pc) {
+      DBG_FAIL_MACRO;
+      return -1;
+    }
+    return !(pc->data[(cluster >> 3) & 0X1FF] & (1 << (cluster & 7)));
+  }
+#endif  // ENABLE_EXFAT
+  fg = fatGet(cluster, &f);
+  return fg < 0 ? -1 : fg && f == 0;
+}
+//------------------------------------------------------------------------------
+// Find the first run of count free clusters in first through last.  The
+// FAT block of first is read through the cache.  With USE_FAT_SCAN_STREAM
+// the blocks after it are read with one multiple block read, so a search
+// across a full part of the FAT costs one command.  Return 1 with the first
+// cluster of the run in bgn, 0 if there is no run, or -1 for an error.
+int8_t FatVolume::freeRun(uint32_t first, uint32_t last, uint32_t count,
+                          uint32_t* bgn) {
+  cache_t* pc = 0;
+  // FAT block in pc.
+  uint32_t lba = 0;
+  // Free clusters in the current run.
+  uint32_t n = 0;
+  uint32_t f;
+  int8_t rtn = 0;
+  // Entries per FAT block as a shift.
+  uint8_t shift = m_fatType == 16 ? 8 : 7;
+#if USE_FAT_SCAN_STREAM
+  bool stream = false;
+#endif  // USE_FAT_SCAN_STREAM
+#if FAT_FREE_SUMMARY_SIZE
+  // True if the search has covered the current group from its start.
+  bool wholeGroup = false;
+  // True if a free cluster was seen in the current group.
+  bool groupFree = false;
+#endif  // FAT_FREE_SUMMARY_SIZE
+  for (uint32_t find = first; find <= last; find++) {
+#if FAT_FREE_SUMMARY_SIZE
+    uint32_t group = find >> m_freeSummaryShift;
+    uint32_t groupEnd = ((group + 1) << m_freeSummaryShift) - 1;
+    if (groupEnd > m_lastCluster) {
+      groupEnd = m_lastCluster;
+    }
+    if (!freeSummaryMayBeFree(group)) {
+      // Skip full group.
+      n = 0;
+      find = groupEnd;
+      continue;
+    }
+    if (find == first || find == (group << m_freeSummaryShift)) {
+      wholeGroup = find == 2 || find == (group << m_freeSummaryShift);
+      groupFree = false;
+    }
+#endif  // FAT_FREE_SUMMARY_SIZE
+    if (FAT12_SUPPORT && m_fatType == 12) {
+      int8_t fg = fatGet(find, &f);
+      if (fg < 0) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      if (fg == 0) {
+        // EOC is in use.
+        f = 1;
+      }
+    } else {
+      uint32_t b = m_fatStartBlock + (find >> shift);
+      if (!pc || b != lba) {
+#if USE_FAT_SCAN_STREAM
+        if (pc) {
+          if (!stream || b != lba + 1) {
+            // Start a stream, or restart it after a skipped group.
+            if (stream) {
+              stream = false;
+              if (!readStop()) {
+                DBG_FAIL_MACRO;
+                goto fail;
+              }
+            }
+            pc = cacheScanBuffer();
+            if (!pc || !readStart(b)) {
+              DBG_FAIL_MACRO;
+              goto fail;
+            }
+            stream = true;
+          }
+          if (!readData(pc->data)) {
+            DBG_FAIL_MACRO;
+            goto fail;
+          }
+        } else  // NOLINT
+#endif  // USE_FAT_SCAN_STREAM
+        {
+          pc = cacheFetchFat(b, FatCache::CACHE_FOR_READ);
+          if (!pc) {
+            DBG_FAIL_MACRO;
+            goto fail;
+          }
+        }
+        lba = b;
+      }
+      f = m_fatType == 16 ? pc->fat16[find & 0XFF]
+                          : pc->fat32[find & 0X7F] & FAT32MASK;
+    }
+    if (f == 0) {
+#if FAT_FREE_SUMMARY_SIZE
+      groupFree = true;
+#endif  // FAT_FREE_SUMMARY_SIZE
+      if (++n == count) {
+        *bgn = find + 1 - count;
+        rtn = 1;
+        break;
+      }
+    } else {
+      n = 0;
+    }
+#if FAT_FREE_SUMMARY_SIZE
+    if (find == groupEnd && wholeGroup && !groupFree) {
+      // No free cluster in group.
+      freeSummarySetFull(group);
+    }
+#endif  // FAT_FREE_SUMMARY_SIZE
+  }
+#if USE_FAT_SCAN_STREAM
+  if (stream && !readStop()) {
+    DBG_FAIL_MACRO;
+    return -1;
+  }
+#endif  // USE_FAT_SCAN_STREAM
+  return rtn;
+
+fail:
+#if USE_FAT_SCAN_STREAM
+  if (stream) {
+    readStop();
+  }
+#endif  // USE_FAT_SCAN_STREAM
+  return -1;
+}
+//------------------------------------------------------------------------------
 // Fetch a FAT entry - return -1 error, 0 EOC, else 1.
 int8_t FatVolume::fatGet(uint32_t cluster, uint32_t* value) {
   uint32_t lba;
@@ -196,7 +491,8 @@ int8_t FatVolume::fatGet(uint32_t cluster, uint32_t* value) {
   // error if reserved cluster of beyond FAT
   DBG_HALT_IF(cluster < 2 || cluster > m_lastCluster);
 
-  if (m_fatType == 32) {
+  // exFAT entries are 32 bits, the mask leaves EOC above m_lastCluster.
+  if (m_fatType >= 32) {
     lba = m_fatStartBlock + (cluster >> 7);
     pc = cacheFetchFat(lba, FatCache::CACHE_FOR_READ);
     if (!pc) {
@@ -263,7 +559,11 @@ bool FatVolume::fatPut(uint32_t cluster, uint32_t value) {
   // error if reserved cluster of beyond FAT
   DBG_HALT_IF(cluster < 2 || cluster > m_lastCluster);
 
-  if (m_fatType == 32) {
+  if (value == 0) {
+    freeSummarySetFree(cluster);
+  }
+
+  if (m_fatType >= 32) {
     lba = m_fatStartBlock + (cluster >> 7);
     pc = cacheFetchFat(lba, FatCache::CACHE_FOR_WRITE);
     if (!pc) {
@@ -329,25 +629,96 @@ fail:
 // free a cluster chain
 bool FatVolume::freeChain(uint32_t cluster) {
   uint32_t next;
+  uint32_t lbn;
+  uint16_t n;
   int8_t fg;
+  cache_t* pc;
+  uint8_t shift = m_fatType == 32 ? 7 : 8;
+  // Contiguous clusters freed so far that end at prev.
+  uint32_t run = 0;
+  uint32_t prev = 0;
+
+  fsInfoChanged();
+#if ENABLE_EXFAT
+  if (m_fatType == 64) {
+    // The FAT is left as is, only the bitmap says a cluster is free.
+    do {
+      fg = fatGet(cluster, &next);
+      if (fg < 0 || !bitmapPut(cluster, 1, false)) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      cluster = next;
+    } while (fg);
+    return true;
+  }
+#endif  // ENABLE_EXFAT
   do {
-    fg = fatGet(cluster, &next);
-    if (fg < 0) {
+    if (cluster < 2 || cluster > m_lastCluster) {
       DBG_FAIL_MACRO;
       goto fail;
     }
-    // free cluster
-    if (!fatPut(cluster, 0)) {
+    if (FAT12_SUPPORT && m_fatType == 12) {
+      if (cluster < m_allocSearchStart) {
+        m_allocSearchStart = cluster;
+      }
+      fg = fatGet(cluster, &next);
+      if (fg < 0) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      // free cluster
+      if (!fatPut(cluster, 0)) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      updateFreeClusterCount(1);
+      run = cluster == prev + 1 ? run + 1 : 1;
+      prev = cluster;
+      if (run >= m_extentFail) {
+        m_extentFail = 0XFFFF;
+      }
+      cluster = next;
+      continue;
+    }
+    // Free all clusters of the chain in this FAT block with one fetch.
+    lbn = cluster >> shift;
+    pc = cacheFetchFat(m_fatStartBlock + lbn, FatCache::CACHE_FOR_WRITE);
+    if (!pc) {
       DBG_FAIL_MACRO;
       goto fail;
     }
-    // Add one to count of free clusters.
-    updateFreeClusterCount(1);
-
-    if (cluster < m_allocSearchStart) {
-      m_allocSearchStart = cluster;
-    }
-    cluster = next;
+    n = 0;
+    do {
+      if (cluster < 2 || cluster > m_lastCluster) {
+        // corrupt chain, count what was freed
+        updateFreeClusterCount(n);
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      if (shift == 7) {
+        next = pc->fat32[cluster & 0X7F] & FAT32MASK;
+        pc->fat32[cluster & 0X7F] = 0;
+      } else {
+        next = pc->fat16[cluster & 0XFF];
+        pc->fat16[cluster & 0XFF] = 0;
+      }
+      freeSummarySetFree(cluster);
+      if (cluster < m_allocSearchStart) {
+        m_allocSearchStart = cluster;
+      }
+      // Retry failed extent searches only if this run could satisfy one.
+      run = cluster == prev + 1 ? run + 1 : 1;
+      prev = cluster;
+      if (run >= m_extentFail) {
+        m_extentFail = 0XFFFF;
+      }
+      n++;
+      fg = !isEOC(next);
+      cluster = next;
+    } while (fg && (cluster >> shift) == lbn);
+    // Add to count of free clusters.
+    updateFreeClusterCount(n);
   } while (fg);
 
   return true;
@@ -367,6 +738,30 @@ int32_t FatVolume::freeClusterCount() {
   uint32_t todo = m_lastCluster + 1;
   uint16_t n;
 
+#if ENABLE_EXFAT
+  if (m_fatType == 64) {
+    // Count clear bits in the allocation bitmap, a byte at a time when
+    // the byte is all free or all used.
+    cache_t* pc = 0;
+    for (uint32_t i = 0; i < todo - 2; i++) {
+      if ((i & 0XFFF) == 0) {
+        pc = cacheFetchData(m_bitmapStart + (i >> 12),
+                            FatCache::CACHE_FOR_READ);
+        if (!pc) {
+          DBG_FAIL_MACRO;
+          goto fail;
+        }
+      }
+      uint8_t b = pc->data[(i >> 3) & 0X1FF];
+      if ((i & 7) == 0 && i + 8 <= todo - 2 && (b == 0 || b == 0XFF)) {
+        free += b ? 0 : 8;
+        i += 7;
+      } else if (!(b & (1 << (i & 7)))) {
+        free++;
+      }
+    }
+  } else
+#endif  // ENABLE_EXFAT
   if (FAT12_SUPPORT && m_fatType == 12) {
     for (unsigned i = 2; i < todo; i++) {
       uint32_t c;
@@ -380,44 +775,203 @@ int32_t FatVolume::freeClusterCount() {
       }
     }
   } else if (m_fatType == 16 || m_fatType == 32) {
+    // Entries per block as a shift.
+    uint8_t shift = m_fatType == 16 ? 8 : 7;
+#if FAT_FREE_SUMMARY_SIZE
+    // Free entries seen in the current free summary group.
+    uint32_t groupFree = 0;
+#endif  // FAT_FREE_SUMMARY_SIZE
+#if USE_FAT_SCAN_STREAM
+    // Stream the whole FAT through the cache buffer with one multi-block
+    // read instead of a read command per block.
+    cache_t* pc = cacheScanBuffer();
+    if (!pc || !readStart(m_fatStartBlock)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+#endif  // USE_FAT_SCAN_STREAM
     lba = m_fatStartBlock;
     while (todo) {
-      cache_t* pc = cacheFetchFat(lba++, FatCache::CACHE_FOR_READ);
+#if USE_FAT_SCAN_STREAM
+      if (!readData(pc->data)) {
+        readStop();
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+#else  // USE_FAT_SCAN_STREAM
+      cache_t* pc = cacheFetchFat(lba, FatCache::CACHE_FOR_READ);
       if (!pc) {
         DBG_FAIL_MACRO;
         goto fail;
       }
-      n = m_fatType == 16 ? 256 : 128;
+#endif  // USE_FAT_SCAN_STREAM
+      n = 1 << shift;
       if (todo < n) {
         n = todo;
       }
-      if (m_fatType == 16) {
-        for (uint16_t i = 0; i < n; i++) {
-          if (pc->fat16[i] == 0) {
-            free++;
+      uint16_t blockFree = 0;
+      // Check two FAT16 entries or one FAT32 entry per word.
+      uint16_t nw = m_fatType == 16 ? n >> 1 : n;
+      for (uint16_t i = 0; i < nw; i++) {
+        uint32_t w = pc->fat32[i];
+        if (w == 0) {
+          blockFree += m_fatType == 16 ? 2 : 1;
+        } else if (m_fatType == 16) {
+          if ((uint16_t)w == 0 || (w >> 16) == 0) {
+            blockFree++;
           }
         }
-      } else {
-        for (uint16_t i = 0; i < n; i++) {
-          if (pc->fat32[i] == 0) {
-            free++;
-          }
+      }
+      if (m_fatType == 16 && (n & 1) && pc->fat16[n - 1] == 0) {
+        blockFree++;
+      }
+      free += blockFree;
+#if FAT_FREE_SUMMARY_SIZE
+      // Mark groups with no free cluster so allocation skips them.
+      uint32_t group = ((lba - m_fatStartBlock) << shift) >> m_freeSummaryShift;
+      groupFree += blockFree;
+      if (todo == n ||
+          group != ((lba + 1 - m_fatStartBlock) << shift) >> m_freeSummaryShift) {
+        if (groupFree == 0) {
+          freeSummarySetFull(group);
         }
+        groupFree = 0;
       }
+#endif  // FAT_FREE_SUMMARY_SIZE
+      lba++;
       todo -= n;
     }
+#if USE_FAT_SCAN_STREAM
+    if (!readStop()) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+#endif  // USE_FAT_SCAN_STREAM
   } else {
     // invalid FAT type
     DBG_FAIL_MACRO;
     goto fail;
   }
   setFreeClusterCount(free);
+  // Save the count at the next sync.
+  fsInfoChanged();
   return free;
 
 fail:
   return -1;
 }
 //------------------------------------------------------------------------------
+#if MAINTAIN_FREE_CLUSTER_COUNT
+// Load free count and next free hint from the FAT32 FSINFO block.
+void FatVolume::fsInfoInit(uint32_t lbn) {
+  cache_t* pc;
+  uint32_t count;
+  uint32_t next;
+  uint32_t first;
+  uint16_t nFree = 0;
+  uint16_t nUsed = 0;
+
+  m_fsInfoBlock = 0;
+  m_fsInfoState = FSINFO_CURRENT;
+  if (!lbn) {
+    return;
+  }
+  pc = cacheFetchData(lbn, FatCache::CACHE_FOR_READ);
+  if (!pc || pc->fsinfo.leadSignature != FSINFO_LEAD_SIG
+      || pc->fsinfo.structSignature != FSINFO_STRUCT_SIG) {
+    // no valid FSINFO - don't create one
+    return;
+  }
+  m_fsInfoBlock = lbn;
+  count = pc->fsinfo.freeCount;
+  next = pc->fsinfo.nextFree;
+  if (next < 2 || next > m_lastCluster) {
+    next = 2;
+  } else {
+    m_allocSearchStart = next - 1;
+  }
+  if (count == 0XFFFFFFFF) {
+    // unknown count, will be computed by freeClusterCount()
+    return;
+  }
+  // Check the count against the FAT block for the next free hint.
+  first = next & ~0X7FUL;
+  pc = cacheFetchFat(m_fatStartBlock + (next >> 7), FatCache::CACHE_FOR_READ);
+  if (!pc) {
+    m_fsInfoState = FSINFO_STALE;
+    return;
+  }
+  for (uint8_t i = 0; i < 128; i++) {
+    uint32_t c = first + i;
+    if (c < 2 || c > m_lastCluster) {
+      continue;
+    }
+    if (pc->fat32[i] & FAT32MASK) {
+      nUsed++;
+    } else {
+      nFree++;
+    }
+  }
+  if (count < nFree || count > clusterCount() - nUsed) {
+    // FSINFO count is not possible, don't trust it.
+    m_fsInfoState = FSINFO_STALE;
+    return;
+  }
+  setFreeClusterCount(count);
+}
+//------------------------------------------------------------------------------
+// Save the free count and next free hint, called after the FAT is synced.
+bool FatVolume::fsInfoSync() {
+  if (!m_fsInfoBlock || m_fsInfoState == FSINFO_CURRENT) {
+    return true;
+  }
+  if (!fsInfoWrite(m_freeClusterCount)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  m_fsInfoState = FSINFO_CURRENT;
+  return true;
+
+fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+bool FatVolume::fsInfoWrite(uint32_t freeCount) {
+  uint32_t next = m_allocSearchStart + 1;
+  // No need to read the block - all fields are rewritten.
+  cache_t* pc = cacheFetchData(m_fsInfoBlock,
+                               FatCache::CACHE_RESERVE_FOR_WRITE);
+  if (!pc) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  memset(pc->data, 0, 512);
+  pc->fsinfo.leadSignature = FSINFO_LEAD_SIG;
+  pc->fsinfo.structSignature = FSINFO_STRUCT_SIG;
+  pc->fsinfo.freeCount = freeCount;
+  pc->fsinfo.nextFree = next > m_lastCluster ? 2 : next;
+  pc->fsinfo.tailSignature[2] = 0X55;
+  pc->fsinfo.tailSignature[3] = 0XAA;
+  return cacheSyncData();
+
+fail:
+  return false;
+}
+#endif  // MAINTAIN_FREE_CLUSTER_COUNT
+//------------------------------------------------------------------------------
+#if FAT_FREE_SUMMARY_SIZE
+void FatVolume::freeSummaryInit() {
+  // Use the smallest group of whole FAT blocks that lets the summary
+  // cover the FAT.  All groups may have free clusters until searched.
+  uint8_t shift = m_fatType == 32 ? 7 : m_fatType == 16 ? 8 : 0;
+  while ((m_lastCluster >> shift) >= 8*FAT_FREE_SUMMARY_SIZE) {
+    shift++;
+  }
+  m_freeSummaryShift = shift;
+  memset(m_freeSummary, 0XFF, sizeof(m_freeSummary));
+}
+#endif  // FAT_FREE_SUMMARY_SIZE
+//------------------------------------------------------------------------------
 bool FatVolume::init(uint8_t part) {
   uint32_t clusterCount;
   uint32_t totalBlocks;
@@ -426,12 +980,20 @@ bool FatVolume::init(uint8_t part) {
   cache_t* pc;
   uint8_t tmp;
   m_fatType = 0;
+  m_exFat = false;
   m_allocSearchStart = 1;
+  m_extentFail = 0XFFFF;
+  setEraseRange(0, 0);
+#if DEFER_FAT_MIRROR
+  m_mirrorFirst = 0;
+#endif  // DEFER_FAT_MIRROR
+#if DIR_INDEX_SIZE
+  // No directory indexed, cluster one is never a directory.
+  m_dirIndexCluster = 1;
+  m_dirIndexCount = 0;
+#endif  // DIR_INDEX_SIZE
 
-  m_cache.init(this);
-#if USE_SEPARATE_FAT_CACHE
-  m_fatCache.init(this);
-#endif  // USE_SEPARATE_FAT_CACHE
+  cacheInit();
 
   // if part == 0 assume super floppy with FAT boot sector in block zero
   // if part > 0 assume mbr volume with partition table
@@ -462,6 +1024,13 @@ bool FatVolume::init(uint8_t part) {
   if (fbs->bytesPerSector != 512 ||
       fbs->fatCount != 2 ||
       fbs->reservedSectorCount == 0) {
+    if (!memcmp(fbs->oemId, "EXFAT   ", sizeof(fbs->oemId))) {
+      // remember exFAT so the app can ask for a FAT format
+      m_exFat = true;
+#if ENABLE_EXFAT
+      return exFatInit(volumeStartBlock);
+#endif  // ENABLE_EXFAT
+    }
     // not valid FAT volume
     DBG_FAIL_MACRO;
     goto fail;
@@ -517,17 +1086,218 @@ bool FatVolume::init(uint8_t part) {
     m_rootDirStart = fbs->fat32RootCluster;
     m_fatType = 32;
   }
+  fsInfoInit(m_fatType == 32 ? volumeStartBlock + fbs->fat32FSInfo : 0);
+  freeSummaryInit();
+  return true;
+
+fail:
+  return false;
+}
+#if ENABLE_EXFAT
+//------------------------------------------------------------------------------
+// Mark count clusters from cluster used or free in the allocation bitmap.
+bool FatVolume::bitmapPut(uint32_t cluster, uint32_t count, bool used) {
+  cache_t* pc;
+  if (cluster < 2 || cluster > m_lastCluster ||
+      count > m_lastCluster - cluster + 1) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  if (!used && cluster <= m_allocSearchStart) {
+    m_allocSearchStart = cluster - 1;
+  }
+  updateFreeClusterCount(used ? -count : count);
+  cluster -= 2;
+  while (count) {
+    pc = cacheFetchData(m_bitmapStart + (cluster >> 12),
+                        FatCache::CACHE_FOR_WRITE);
+    if (!pc) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    // Bits of this bitmap block.
+    do {
+      uint8_t* p = &pc->data[(cluster >> 3) & 0X1FF];
+      uint8_t mask = 1 << (cluster & 7);
+      *p = used ? *p | mask : *p & ~mask;
+      cluster++;
+    } while (--count && (cluster & 0XFFF));
+  }
   return true;
 
 fail:
   return false;
 }
 //------------------------------------------------------------------------------
+// Allocate the first free cluster from hint, or from the search start if
+// hint is zero.  The FAT isn't changed, the caller links the cluster if it
+// isn't contiguous with the file.
+bool FatVolume::exFatAllocate(uint32_t hint, uint32_t* cluster) {
+  cache_t* pc = 0;
+  uint32_t find = hint ? hint : m_allocSearchStart + 1;
+  // Clusters left to check.
+  uint32_t todo = m_lastCluster - 1;
+  if (find < 2 || find > m_lastCluster) {
+    find = 2;
+  }
+  while (todo) {
+    uint32_t bit = find - 2;
+    if (!pc || (bit & 0XFFF) == 0) {
+      pc = cacheFetchData(m_bitmapStart + (bit >> 12),
+                          FatCache::CACHE_FOR_READ);
+      if (!pc) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+    }
+    uint8_t b = pc->data[(bit >> 3) & 0X1FF];
+    if ((bit & 7) == 0 && b == 0XFF && todo >= 8 && find + 7 <= m_lastCluster) {
+      // Skip eight used clusters.
+      find += 8;
+      todo -= 8;
+    } else if (b & (1 << (bit & 7))) {
+      find++;
+      todo--;
+    } else {
+      if (!bitmapPut(find, 1, true)) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      if (!hint) {
+        // Remember place for search start.
+        m_allocSearchStart = find;
+      }
+      *cluster = find;
+      return true;
+    }
+    if (find > m_lastCluster) {
+      // Wrap to the start of the bitmap.
+      find = 2;
+      pc = 0;
+    }
+  }
+  // Can't find space checked all clusters.
+  DBG_FAIL_MACRO;
+
+fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+bool FatVolume::exFatInit(uint32_t volumeStartBlock) {
+  exfat_boot_t* pb;
+  exfat_bitmap_t* bitmap = 0;
+  cache_t* pc;
+  uint32_t cluster;
+  uint32_t next;
+  int8_t fg;
+
+  pc = cacheFetchData(volumeStartBlock, FatCache::CACHE_FOR_READ);
+  if (!pc) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  pb = reinterpret_cast<exfat_boot_t*>(pc->data);
+  // 512 byte sectors, clusters up to 128 KB and one FAT.
+  if (pb->bytesPerSectorShift != 9 || pb->sectorsPerClusterShift > 8 ||
+      pb->numberOfFats != 1 || pb->clusterCount < 2 ||
+      pb->clusterCount > 0XFFFFFFF5) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  m_clusterSizeShift = pb->sectorsPerClusterShift;
+  m_blocksPerCluster = 1 << m_clusterSizeShift;
+  m_clusterBlockMask = m_blocksPerCluster - 1;
+  m_blocksPerFat = pb->fatLength;
+  m_fatStartBlock = volumeStartBlock + pb->fatOffset;
+  m_dataStartBlock = volumeStartBlock + pb->clusterHeapOffset;
+  m_lastCluster = pb->clusterCount + 1;
+  m_rootDirStart = pb->rootDirectoryCluster;
+  m_rootDirEntryCount = 0;
+  m_fatType = 64;
+  setFreeClusterCount(-1);
+  fsInfoInit(0);
+
+  // Find the allocation bitmap in the root directory.
+  cluster = m_rootDirStart;
+  while (!bitmap) {
+    if (cluster < 2 || cluster > m_lastCluster) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    for (uint16_t i = 0; i < 16*m_blocksPerCluster; i++) {
+      if ((i & 0XF) == 0) {
+        pc = cacheFetchData(clusterStartBlock(cluster) + (i >> 4),
+                            FatCache::CACHE_FOR_READ);
+        if (!pc) {
+          DBG_FAIL_MACRO;
+          goto fail;
+        }
+      }
+      uint8_t type = pc->dir[i & 0XF].name[0];
+      if (type == 0) {
+        // end of directory
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      if (type == EXFAT_TYPE_BITMAP) {
+        bitmap = reinterpret_cast<exfat_bitmap_t*>(&pc->dir[i & 0XF]);
+        break;
+      }
+    }
+    if (!bitmap && fatGet(cluster, &cluster) <= 0) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+  }
+  cluster = bitmap->firstCluster;
+  if (cluster < 2 || cluster > m_lastCluster ||
+      bitmap->dataLength < (m_lastCluster + 6)/8) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  m_bitmapStart = clusterStartBlock(cluster);
+  // The bitmap is read as one run of blocks so it must be contiguous.
+  for (uint32_t n = ((m_lastCluster - 2) >> (m_clusterSizeShift + 12)) + 1;
+       n > 1; n--) {
+    fg = fatGet(cluster, &next);
+    if (fg <= 0 || next != cluster + 1) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    cluster = next;
+  }
+  return true;
+
+fail:
+  m_fatType = 0;
+  return false;
+}
+#endif  // ENABLE_EXFAT
+#if DEFER_FAT_MIRROR
+//------------------------------------------------------------------------------
+// Copy deferred blocks of the first FAT to the second FAT.
+bool FatVolume::mirrorSync() {
+  while (m_mirrorFirst) {
+    cache_t* pc = cacheFetchFat(m_mirrorFirst, FatCache::CACHE_FOR_READ);
+    if (!pc || !writeBlock(m_mirrorFirst + m_blocksPerFat, pc->data)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    m_mirrorFirst = m_mirrorFirst < m_mirrorLast ? m_mirrorFirst + 1 : 0;
+  }
+  return true;
+
+fail:
+  return false;
+}
+#endif  // DEFER_FAT_MIRROR
+//------------------------------------------------------------------------------
 bool FatVolume::wipe(print_t* pr) {
   cache_t* cache;
   uint16_t count;
   uint32_t lbn;
-  if (!m_fatType) {
+  // exFAT volumes must be formatted again, not wiped.
+  if (!m_fatType || m_fatType == 64) {
     DBG_FAIL_MACRO;
     goto fail;
   }
@@ -587,6 +1357,14 @@ bool FatVolume::wipe(print_t* pr) {
       DBG_FAIL_MACRO;
       goto fail;
     }
+#if MAINTAIN_FREE_CLUSTER_COUNT
+    // All but the root cluster are free.
+    m_allocSearchStart = 1;
+    if (m_fsInfoBlock && !fsInfoWrite(clusterCount() - 1)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+#endif  // MAINTAIN_FREE_CLUSTER_COUNT
   }
   if (pr) {
     pr->write('\r');
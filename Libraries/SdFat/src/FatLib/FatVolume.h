@@ -158,10 +158,10 @@ class FatVolume {
  public:
   /** Create an instance of FatVolume
    */
-  FatVolume() : m_fatType(0) {}
+  FatVolume() : m_fatType(0), m_exFat(false) {}
 
   /** \return The volume's cluster size in blocks. */
-  uint8_t blocksPerCluster() const {
+  uint16_t blocksPerCluster() const {
     return m_blocksPerCluster;
   }
   /** \return The number of blocks in one FAT. */
@@ -175,9 +175,26 @@ class FatVolume {
     if (!cacheSync()) {
       return 0;
     }
-    m_cache.invalidate();
-    return m_cache.block();
+    cacheInvalidate();
+    return cacheAddress();
   }
+#if ENABLE_SD_WRITE_STREAM
+  /** Blocks a multiple block write may ask the device to pre-erase.
+   * Not for normal apps.
+   *
+   * While FatFile::write() appends to a file, the blocks from the end of
+   * the file to the end of its cluster hold no data.  A write that starts
+   * in them can pre-erase to the end of the cluster, even if it is ended
+   * early.
+   *
+   * \param[in] block First block of the write.
+   * \return Blocks to pre-erase from block, zero if unknown.
+   */
+  uint32_t writeEraseCount(uint32_t block) const {
+    return m_eraseFirst <= block && block <= m_eraseLast
+           ? m_eraseLast - block + 1 : 0;
+  }
+#endif  // ENABLE_SD_WRITE_STREAM
   /** \return The total number of clusters in the volume. */
   uint32_t clusterCount() const {
     return m_lastCluster - 1;
@@ -191,17 +208,24 @@ class FatVolume {
     return m_dataStartBlock;
   }
   /** \return The number of File Allocation Tables. */
-  uint8_t fatCount() {
-    return 2;
+  uint8_t fatCount() const {
+    return ENABLE_EXFAT && m_fatType == 64 ? 1 : 2;
   }
   /** \return The logical block number for the start of the first FAT. */
   uint32_t fatStartBlock() const {
     return m_fatStartBlock;
   }
-  /** \return The FAT type of the volume. Values are 12, 16 or 32. */
+  /** \return The FAT type of the volume. Values are 12, 16, 32 or 64 for
+   * exFAT. */
   uint8_t fatType() const {
     return m_fatType;
   }
+  /** \return true if the volume is exFAT or init() failed on an exFAT
+   * volume.  init() fails on all exFAT volumes if ENABLE_EXFAT is zero.
+   */
+  bool isExFat() const {
+    return m_exFat;
+  }
   /** Volume free space in clusters.
    *
    * \return Count of free clusters for success or -1 if an error occurs.
@@ -214,7 +238,16 @@ class FatVolume {
    * the value false is returned for failure. 
    */
   bool init() {
-    return init(1) || init(0);
+    if (init(1)) {
+      return true;
+    }
+    // Keep an exFAT partition one found by the first try.
+    bool exFat = m_exFat;
+    if (init(0)) {
+      return true;
+    }
+    m_exFat |= exFat;
+    return false;
   }
   /** Initialize a FAT volume.
 
@@ -260,20 +293,41 @@ class FatVolume {
   friend class FatCache;
   friend class FatFile;
 //------------------------------------------------------------------------------
-  uint8_t  m_blocksPerCluster;     // Cluster size in blocks.
-  uint8_t  m_clusterBlockMask;     // Mask to extract block of cluster.
+  uint16_t m_blocksPerCluster;     // Cluster size in blocks.
+  uint16_t m_clusterBlockMask;     // Mask to extract block of cluster.
   uint8_t  m_clusterSizeShift;     // Cluster count to block count shift.
-  uint8_t  m_fatType;              // Volume type (12, 16, OR 32).
+  uint8_t  m_fatType;              // Volume type (12, 16, 32 OR 64).
+  bool     m_exFat;                // Volume or last failed init() is exFAT.
   uint16_t m_rootDirEntryCount;    // Number of entries in FAT16 root dir.
+  uint16_t m_extentFail;           // No free run this long since a run this long was freed.
   uint32_t m_allocSearchStart;     // Start cluster for alloc search.
   uint32_t m_blocksPerFat;         // FAT size in blocks
   uint32_t m_dataStartBlock;       // First data block number.
   uint32_t m_fatStartBlock;        // Start block for first FAT.
   uint32_t m_lastCluster;          // Last cluster number in FAT.
   uint32_t m_rootDirStart;         // Start block for FAT16, cluster for FAT32.
+#if ENABLE_EXFAT
+  uint32_t m_bitmapStart;          // First block of exFAT allocation bitmap.
+#endif  // ENABLE_EXFAT
+#if ENABLE_SD_WRITE_STREAM
+  uint32_t m_eraseFirst;           // First block free to pre-erase.
+  uint32_t m_eraseLast;            // Last block free to pre-erase, 0 if none.
+  void setEraseRange(uint32_t first, uint32_t last) {
+    m_eraseFirst = first;
+    m_eraseLast = last;
+  }
+#else  // ENABLE_SD_WRITE_STREAM
+  void setEraseRange(uint32_t first, uint32_t last) {}
+#endif  // ENABLE_SD_WRITE_STREAM
 //------------------------------------------------------------------------------
 #if MAINTAIN_FREE_CLUSTER_COUNT
+  // FSINFO on the device matches the volume.
+  static const uint8_t FSINFO_CURRENT = 0;
+  // FSINFO must be rewritten at the next sync.
+  static const uint8_t FSINFO_STALE = 1;
   int32_t  m_freeClusterCount;     // Count of free clusters in volume.
+  uint32_t m_fsInfoBlock;          // FAT32 FSINFO block or zero if none.
+  uint8_t  m_fsInfoState;          // State of FSINFO on the device.
   void setFreeClusterCount(int32_t value) {
     m_freeClusterCount = value;
   }
@@ -282,12 +336,115 @@ class FatVolume {
       m_freeClusterCount += change;
     }
   }
+  // The FAT changed, FSINFO is written at the next sync.  FSINFO is only a
+  // hint so the device copy may be old until then.
+  void fsInfoChanged() {
+    m_fsInfoState = FSINFO_STALE;
+  }
+  void fsInfoInit(uint32_t lbn);
+  bool fsInfoSync();
+  bool fsInfoWrite(uint32_t freeCount);
 #else  // MAINTAIN_FREE_CLUSTER_COUNT
   void setFreeClusterCount(int32_t value) {}
   void updateFreeClusterCount(int32_t change) {}
+  void fsInfoChanged() {}
+  void fsInfoInit(uint32_t lbn) {}
+  bool fsInfoSync() {
+    return true;
+  }
 #endif  // MAINTAIN_FREE_CLUSTER_COUNT
+//------------------------------------------------------------------------------
+#if FAT_FREE_SUMMARY_SIZE
+  // Bit set if the group of clusters may have a free cluster.
+  uint8_t  m_freeSummary[FAT_FREE_SUMMARY_SIZE];
+  uint8_t  m_freeSummaryShift;     // Cluster number to group shift.
+  void freeSummaryInit();
+  bool freeSummaryMayBeFree(uint32_t group) {
+    return m_freeSummary[group >> 3] & (1 << (group & 7));
+  }
+  void freeSummarySetFull(uint32_t group) {
+    m_freeSummary[group >> 3] &= ~(1 << (group & 7));
+  }
+  void freeSummarySetFree(uint32_t cluster) {
+    uint32_t group = cluster >> m_freeSummaryShift;
+    m_freeSummary[group >> 3] |= 1 << (group & 7);
+  }
+#else  // FAT_FREE_SUMMARY_SIZE
+  void freeSummaryInit() {}
+  void freeSummarySetFull(uint32_t group) {}
+  void freeSummarySetFree(uint32_t cluster) {}
+#endif  // FAT_FREE_SUMMARY_SIZE
 
+#if DEFER_FAT_MIRROR
+  uint32_t m_mirrorFirst;  // First FAT block not mirrored, zero if none.
+  uint32_t m_mirrorLast;   // Last FAT block not mirrored.
+  // Add lbn to the blocks to mirror at sync.  Return false if it is not
+  // next to the deferred blocks and must be mirrored now.
+  bool mirrorDefer(uint32_t lbn) {
+    if (m_mirrorFirst == 0) {
+      m_mirrorFirst = m_mirrorLast = lbn;
+    } else if (lbn + 1 == m_mirrorFirst) {
+      m_mirrorFirst = lbn;
+    } else if (lbn == m_mirrorLast + 1) {
+      m_mirrorLast = lbn;
+    } else if (lbn < m_mirrorFirst || lbn > m_mirrorLast) {
+      return false;
+    }
+    return true;
+  }
+  bool mirrorSync();
+#else  // DEFER_FAT_MIRROR
+  bool mirrorSync() {
+    return true;
+  }
+#endif  // DEFER_FAT_MIRROR
+#if DIR_INDEX_SIZE
+  uint32_t m_dirIndexCluster;  // First cluster of indexed directory.
+  uint16_t m_dirIndexCount;    // Number of leading entries indexed.
+  // Value of each indexed entry from FatFile::dirIndexValue().
+  uint8_t  m_dirIndex[DIR_INDEX_SIZE];
+  // Set the value of entry i.  Entries are indexed in order from the start
+  // of the directory.
+  void dirIndexPut(uint16_t i, uint8_t value) {
+    if (i < m_dirIndexCount) {
+      m_dirIndex[i] = value;
+    } else if (i == m_dirIndexCount && i < DIR_INDEX_SIZE) {
+      m_dirIndex[m_dirIndexCount++] = value;
+    }
+  }
+#endif  // DIR_INDEX_SIZE
+//------------------------------------------------------------------------------
 // block caches
+#if FAT_CACHE_BLOCKS > 1
+  FatCache m_cache[FAT_CACHE_BLOCKS];
+  // Indices of m_cache entries, most recently used first.
+  uint8_t m_cacheLru[FAT_CACHE_BLOCKS];
+  FatCache* cacheMru() {
+    return &m_cache[m_cacheLru[0]];
+  }
+  cache_t* cacheFetchData(uint32_t blockNumber, uint8_t options);
+  cache_t* cacheFetchFat(uint32_t blockNumber, uint8_t options) {
+    return cacheFetchData(blockNumber,
+                          options | FatCache::CACHE_STATUS_MIRROR_FAT);
+  }
+  void cacheInit();
+  bool cacheInRange(uint32_t lbn, uint16_t count);
+  void cacheInvalidate();
+  void cacheInvalidateRange(uint32_t lbn, uint16_t count);
+  bool cacheSync();
+  bool cacheSyncData() {
+    return cacheMru()->sync();
+  }
+  cache_t *cacheAddress() {
+    return cacheMru()->block();
+  }
+  uint32_t cacheBlockNumber() {
+    return cacheMru()->lbn();
+  }
+  void cacheDirty() {
+    cacheMru()->dirty();
+  }
+#else  // FAT_CACHE_BLOCKS > 1
   FatCache m_cache;
 #if USE_SEPARATE_FAT_CACHE
   FatCache m_fatCache;
@@ -296,7 +453,8 @@ class FatVolume {
                            options | FatCache::CACHE_STATUS_MIRROR_FAT);
   }
   bool cacheSync() {
-    return m_cache.sync() && m_fatCache.sync();
+    return m_cache.sync() && m_fatCache.sync() && mirrorSync() &&
+           fsInfoSync() && syncBlocks();
   }
 #else  //
   cache_t* cacheFetchFat(uint32_t blockNumber, uint8_t options) {
@@ -304,15 +462,29 @@ class FatVolume {
                           options | FatCache::CACHE_STATUS_MIRROR_FAT);
   }
   bool cacheSync() {
-    return m_cache.sync();
+    return m_cache.sync() && mirrorSync() && fsInfoSync() && syncBlocks();
   }
 #endif  // USE_SEPARATE_FAT_CACHE
   cache_t* cacheFetchData(uint32_t blockNumber, uint8_t options) {
     return m_cache.read(blockNumber, options);
   }
+  void cacheInit() {
+    m_cache.init(this);
+#if USE_SEPARATE_FAT_CACHE
+    m_fatCache.init(this);
+#endif  // USE_SEPARATE_FAT_CACHE
+  }
+  bool cacheInRange(uint32_t lbn, uint16_t count) {
+    return lbn <= m_cache.lbn() && m_cache.lbn() - lbn < count;
+  }
   void cacheInvalidate() {
     m_cache.invalidate();
   }
+  void cacheInvalidateRange(uint32_t lbn, uint16_t count) {
+    if (cacheInRange(lbn, count)) {
+      m_cache.invalidate();
+    }
+  }
   bool cacheSyncData() {
     return m_cache.sync();
   }
@@ -325,29 +497,54 @@ class FatVolume {
   void cacheDirty() {
     m_cache.dirty();
   }
+#endif  // FAT_CACHE_BLOCKS > 1
 //------------------------------------------------------------------------------
   bool allocateCluster(uint32_t current, uint32_t* next);
   bool allocContiguous(uint32_t count, uint32_t* firstCluster);
-  uint8_t blockOfCluster(uint32_t position) const {
+  bool allocExtent(uint32_t current, uint16_t count, uint32_t* next);
+  uint16_t blockOfCluster(uint32_t position) const {
     return (position >> 9) & m_clusterBlockMask;
   }
   uint32_t clusterStartBlock(uint32_t cluster) const;
+  bool eraseFree(uint32_t cluster, uint32_t count);
   int8_t fatGet(uint32_t cluster, uint32_t* value);
   bool fatPut(uint32_t cluster, uint32_t value);
   bool fatPutEOC(uint32_t cluster) {
-    return fatPut(cluster, 0x0FFFFFFF);
+    return fatPut(cluster, fatCount() == 1 ? EXFAT_EOC : 0x0FFFFFFF);
   }
   bool freeChain(uint32_t cluster);
   bool isEOC(uint32_t cluster) const {
     return cluster > m_lastCluster;
   }
+  int8_t isFree(uint32_t cluster);
+  int8_t freeRun(uint32_t first, uint32_t last, uint32_t count,
+                 uint32_t* bgn);
+#if USE_FAT_SCAN_STREAM
+  cache_t* cacheScanBuffer();
+#endif  // USE_FAT_SCAN_STREAM
+#if ENABLE_EXFAT
+  // exFAT keeps cluster allocation in a bitmap.  The FAT only links the
+  // clusters of fragmented files.
+  bool bitmapPut(uint32_t cluster, uint32_t count, bool used);
+  bool exFatAllocate(uint32_t hint, uint32_t* cluster);
+  bool exFatInit(uint32_t volumeStartBlock);
+#endif  // ENABLE_EXFAT
   //----------------------------------------------------------------------------
   // Virtual block I/O functions.
   virtual bool readBlock(uint32_t block, uint8_t* dst) = 0;
   virtual bool writeBlock(uint32_t block, const uint8_t* src) = 0;
+  virtual bool eraseBlocks(uint32_t firstBlock, uint32_t lastBlock) = 0;
+  // Finish writes the device may hold open, called at the end of cacheSync().
+  virtual bool syncBlocks() = 0;
 #if USE_MULTI_BLOCK_IO
   virtual bool readBlocks(uint32_t block, uint8_t* dst, size_t nb) = 0;
   virtual bool writeBlocks(uint32_t block, const uint8_t* src, size_t nb) = 0;
 #endif  // USE_MULTI_BLOCK_IO
+#if USE_FAT_SCAN_STREAM
+  // Streaming read of consecutive blocks, used to scan the FAT.
+  virtual bool readStart(uint32_t block) = 0;
+  virtual bool readData(uint8_t* dst) = 0;
+  virtual bool readStop() = 0;
+#endif  // USE_FAT_SCAN_STREAM
 };
 #endif  // FatVolume
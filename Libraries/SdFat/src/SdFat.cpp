@@ -78,6 +78,8 @@ void SdFatBase::initErrorPrint(Print* pr) {
       pr->println(F("No card, wrong chip select pin, or SPI problem?"));
     }
     errorPrint(pr);
+  } else if (vol()->isExFat() && vol()->fatType() == 0) {
+    pr->println(F("Can't mount exFAT volume, reformat SD as FAT32."));
   } else if (vol()->fatType() == 0) {
     pr->println(F("Invalid format, reformat SD."));
   } else if (!vwd()->isOpen()) {
@@ -242,13 +242,36 @@ class SdFatBase : public FatFileSystem {
     return m_sdCard.readBlock(block, dst);
   }
   bool writeBlock(uint32_t block, const uint8_t* src) {
+#if ENABLE_SD_WRITE_STREAM
+    return m_sdCard.writeStream(block, src, 1, writeEraseCount(block));
+#else  // ENABLE_SD_WRITE_STREAM
     return m_sdCard.writeBlock(block, src);
+#endif  // ENABLE_SD_WRITE_STREAM
+  }
+  bool syncBlocks() {
+    return m_sdCard.syncBlocks();
+  }
+  bool eraseBlocks(uint32_t firstBlock, uint32_t lastBlock) {
+    return m_sdCard.erase(firstBlock, lastBlock);
   }
   bool readBlocks(uint32_t block, uint8_t* dst, size_t n) {
     return m_sdCard.readBlocks(block, dst, n);
   }
   bool writeBlocks(uint32_t block, const uint8_t* src, size_t n) {
+#if ENABLE_SD_WRITE_STREAM
+    return m_sdCard.writeStream(block, src, n, writeEraseCount(block));
+#else  // ENABLE_SD_WRITE_STREAM
     return m_sdCard.writeBlocks(block, src, n);
+#endif  // ENABLE_SD_WRITE_STREAM
+  }
+  bool readStart(uint32_t block) {
+    return m_sdCard.readStart(block);
+  }
+  bool readData(uint8_t* dst) {
+    return m_sdCard.readData(dst);
+  }
+  bool readStop() {
+    return m_sdCard.readStop();
   }
   SdSpiCard m_sdCard;
 };
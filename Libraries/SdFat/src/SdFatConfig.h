@@ -113,8 +113,141 @@ uint8_t const SOFT_SPI_SCK_PIN = 13;
  * Set MAINTAIN_FREE_CLUSTER_COUNT nonzero to keep the count of free clusters
  * updated.  This will increase the speed of the freeClusterCount() call
  * after the first call.  Extra flash will be required.
+ *
+ * On FAT32 volumes the free count and next free cluster hint are also loaded
+ * from the FSINFO block at init() and saved back when the cache is synced.
+ *
+ * Off on small AVR boards to save flash.
  */
+#if defined(RAMEND) && RAMEND < 3000
 #define MAINTAIN_FREE_CLUSTER_COUNT 0
+#else  // RAMEND
+#define MAINTAIN_FREE_CLUSTER_COUNT 1
+#endif  // RAMEND
+//------------------------------------------------------------------------------
+/**
+ * Set FAT_FREE_SUMMARY_SIZE nonzero to keep a summary of which parts of the
+ * FAT may still have free clusters.  The summary is FAT_FREE_SUMMARY_SIZE
+ * bytes of RAM with one bit per group of FAT blocks.  A bit is cleared when
+ * an allocation search finds its group full and set when a cluster in the
+ * group is freed.  Allocation skips full groups so the time to add a cluster
+ * is bounded on a nearly full or fragmented volume.
+ *
+ * Off on small AVR boards to save flash.
+ */
+#if defined(RAMEND) && RAMEND < 3000
+#define FAT_FREE_SUMMARY_SIZE 0
+#else  // RAMEND
+#define FAT_FREE_SUMMARY_SIZE 16
+#endif  // RAMEND
+//------------------------------------------------------------------------------
+/**
+ * Set DEFER_FAT_MIRROR nonzero to update the second FAT when the cache is
+ * synced instead of each time a FAT block is written.  Writes to a run of
+ * adjacent FAT blocks are deferred, other FAT blocks are mirrored as before.
+ * Between syncs only the first FAT, which is used to access files, is
+ * current.
+ *
+ * Off on small AVR boards to save flash.
+ */
+#if defined(RAMEND) && RAMEND < 3000
+#define DEFER_FAT_MIRROR 0
+#else  // RAMEND
+#define DEFER_FAT_MIRROR 1
+#endif  // RAMEND
+//------------------------------------------------------------------------------
+/**
+ * Set FILE_EXTENT_MAP_SIZE nonzero to keep a map of up to FILE_EXTENT_MAP_SIZE
+ * runs of contiguous clusters in each open file.  The map is built as
+ * seekSet() follows the cluster chain so later seeks into mapped clusters
+ * need no FAT access.  The map costs five bytes of RAM per file plus eight
+ * bytes per run, or four bytes per run when FILE_EXTENT_MAP_SIZE is one since
+ * the only run then starts at the first cluster of the file.  Off on small
+ * AVR boards to save flash.
+ */
+#ifdef __arm__
+#define FILE_EXTENT_MAP_SIZE 4
+#elif defined(RAMEND) && RAMEND < 3000
+#define FILE_EXTENT_MAP_SIZE 0
+#else  // __arm__
+#define FILE_EXTENT_MAP_SIZE 1
+#endif  // __arm__
+//------------------------------------------------------------------------------
+/**
+ * Set DIR_INDEX_SIZE nonzero to index the first DIR_INDEX_SIZE entries of the
+ * most recently searched directory.  The index is one byte of RAM per entry
+ * holding a checksum of the short name.  Opening an 8.3 name only reads the
+ * directory blocks whose entries have a matching checksum, plus any entries
+ * past the end of the index.  Names that need a long file name entry are
+ * found by a full search as before.
+ */
+#ifdef __arm__
+#define DIR_INDEX_SIZE 1024
+#else  // __arm__
+#define DIR_INDEX_SIZE 0
+#endif  // __arm__
+//------------------------------------------------------------------------------
+/**
+ * Set ENABLE_EXFAT nonzero to mount exFAT volumes, the format of new SDXC
+ * cards.  Files can be created, read, appended, truncated and removed.
+ * Files are limited to 4 GB.  mkdir(), rmdir(), rename(), timestamp() and
+ * createContiguous() fail.  Requires USE_LONG_FILE_NAMES.
+ *
+ * Off on small AVR boards to save flash.
+ */
+#if defined(RAMEND) && RAMEND < 3000
+#define ENABLE_EXFAT 0
+#else  // RAMEND
+#define ENABLE_EXFAT 1
+#endif  // RAMEND
+//------------------------------------------------------------------------------
+/**
+ * Set ENABLE_SD_LATENCY_STATS nonzero to keep log2 histograms of the time
+ * SdSpiCard spends in busy waits and multiple block writes.  Two also keeps
+ * commands, block reads and single block writes.  Recording costs a micros()
+ * call and a few counter updates per operation.  Failures and timeouts are
+ * recorded and counted.
+ *
+ * One takes 38 bytes of RAM with counts that stop at 255, two takes 170
+ * bytes with counts that stop at 65535.  Off on small AVR boards to save
+ * flash.
+ */
+#ifdef __arm__
+#define ENABLE_SD_LATENCY_STATS 2
+#elif defined(RAMEND) && RAMEND < 3000
+#define ENABLE_SD_LATENCY_STATS 0
+#else  // __arm__
+#define ENABLE_SD_LATENCY_STATS 1
+#endif  // __arm__
+//------------------------------------------------------------------------------
+/**
+ * Set ENABLE_SD_READ_STREAM nonzero to add SdSpiCard::readStreamBegin() and
+ * readStreamEnd().  Between these calls a multiple block read stays open for
+ * as long as the blocks read follow each other, so a sequential file read
+ * costs one command per contiguous run instead of one per block.
+ *
+ * Off on small AVR boards to save flash.
+ */
+#if defined(RAMEND) && RAMEND < 3000
+#define ENABLE_SD_READ_STREAM 0
+#else  // RAMEND
+#define ENABLE_SD_READ_STREAM 1
+#endif  // RAMEND
+//------------------------------------------------------------------------------
+/**
+ * Set ENABLE_SD_WRITE_STREAM nonzero to merge block writes to adjacent
+ * blocks into one multiple block write.  SdFat leaves the write open after
+ * each block and continues it if the next write is to the following block.
+ * A read, any other command or a sync ends it, so the number of commands
+ * and busy waits per block drops without buffering any data.
+ *
+ * Off on small AVR boards to save flash.
+ */
+#if defined(RAMEND) && RAMEND < 3000
+#define ENABLE_SD_WRITE_STREAM 0
+#else  // RAMEND
+#define ENABLE_SD_WRITE_STREAM 1
+#endif  // RAMEND
 //------------------------------------------------------------------------------
 /**
  * To enable SD card CRC checking set USE_SD_CRC nonzero.
@@ -122,6 +255,14 @@ uint8_t const SOFT_SPI_SCK_PIN = 13;
  * Set USE_SD_CRC to 1 to use a smaller slower CRC-CCITT function.
  *
  * Set USE_SD_CRC to 2 to used a larger faster table driven CRC-CCITT function.
+ * Commands also use a table driven CRC7.
+ *
+ * Set USE_SD_CRC to 3 to use the tables of 2 and, on AVR with hardware SPI,
+ * compute the CRC of each data byte while the next byte is on the bus.
+ * The CRC then adds almost no time to a block transfer.
+ * Other configurations treat 3 as 2.
+ *
+ * The CrcBench example measures the cost of each setting.
  */
 #define USE_SD_CRC 0
 //------------------------------------------------------------------------------
@@ -198,6 +339,19 @@ const uint8_t SPI_SCK_INIT_DIVISOR = 128;
 #define USE_SEPARATE_FAT_CACHE 0
 #endif  // __arm__
 //------------------------------------------------------------------------------
+/**
+ * Set FAT_CACHE_BLOCKS to the number of 512 byte blocks to cache.  With more
+ * than one block, directory, FAT and data blocks share a cache with least
+ * recently used replacement and USE_SEPARATE_FAT_CACHE is not used.  This
+ * avoids re-reading blocks when directory searches, FAT access and file
+ * access are mixed.
+ */
+#ifdef __arm__
+#define FAT_CACHE_BLOCKS 4
+#else  // __arm__
+#define FAT_CACHE_BLOCKS 1
+#endif  // __arm__
+//------------------------------------------------------------------------------
 /**
  * Set USE_MULTI_BLOCK_IO nonzero to use multi-block SD read/write.
  *
@@ -208,4 +362,19 @@ const uint8_t SPI_SCK_INIT_DIVISOR = 128;
 #else  // RAMEND
 #define USE_MULTI_BLOCK_IO 1
 #endif  // RAMEND
+//------------------------------------------------------------------------------
+/**
+ * Set USE_FAT_SCAN_STREAM nonzero to read the FAT with one multiple block
+ * read when freeClusterCount() counts free clusters and when an allocation
+ * search moves past its first FAT block.  The blocks are read into the
+ * cache buffer so no RAM is added.  This is independent of
+ * USE_MULTI_BLOCK_IO.
+ *
+ * Off on small AVR boards to save flash.
+ */
+#if defined(RAMEND) && RAMEND < 3000
+#define USE_FAT_SCAN_STREAM 0
+#else  // RAMEND
+#define USE_FAT_SCAN_STREAM 1
+#endif  // RAMEND
 #endif  // SdFatConfig_h
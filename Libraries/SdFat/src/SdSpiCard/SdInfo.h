@@ -88,6 +88,8 @@ uint8_t const SD_CARD_ERROR_CMD59 = 0X1A;
 uint8_t const SD_CARD_ERROR_READ_CRC = 0X1B;
 /** SPI DMA error */
 uint8_t const SD_CARD_ERROR_SPI_DMA = 0X1C;
+/** card returned an error for ACMD13 (SD_STATUS) */
+uint8_t const SD_CARD_ERROR_ACMD13 = 0X1D;
 //------------------------------------------------------------------------------
 // card types
 /** Standard capacity V1 SD card */
@@ -157,6 +159,8 @@ uint8_t const CMD55 = 0X37;
 uint8_t const CMD58 = 0X3A;
 /** CRC_ON_OFF - enable or disable CRC checking */
 uint8_t const CMD59 = 0X3B;
+/** SD_STATUS - read the 64 byte SD Status register */
+uint8_t const ACMD13 = 0X0D;
 /** SET_WR_BLK_ERASE_COUNT - Set the number of write blocks to be
      pre-erased before writing */
 uint8_t const ACMD23 = 0X17;
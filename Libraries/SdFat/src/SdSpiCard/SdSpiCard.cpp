@@ -22,10 +22,32 @@
 // debug trace macro
 #define SD_TRACE(m, b)
 // #define SD_TRACE(m, b) Serial.print(m);Serial.println(b);
+// latency histogram macros
+#if ENABLE_SD_LATENCY_STATS
+#define LATENCY_START(t) uint32_t t = micros()
+#define LATENCY_RECORD(op, t, ok) latencyRecord(op, t, ok)
+#else  // ENABLE_SD_LATENCY_STATS
+#define LATENCY_START(t)
+#define LATENCY_RECORD(op, t, ok)
+#endif  // ENABLE_SD_LATENCY_STATS
+// operations only kept by the full histograms
+#if ENABLE_SD_LATENCY_STATS > 1
+#define FULL_LATENCY_START(t) LATENCY_START(t)
+#define FULL_LATENCY_RECORD(op, t, ok) LATENCY_RECORD(op, t, ok)
+#else  // ENABLE_SD_LATENCY_STATS > 1
+#define FULL_LATENCY_START(t)
+#define FULL_LATENCY_RECORD(op, t, ok)
+#endif  // ENABLE_SD_LATENCY_STATS > 1
+#if SD_STREAM_IO
+// values of m_streamState
+const uint8_t STREAM_READ = 1;
+const uint8_t STREAM_WRITE = 2;
+#endif  // SD_STREAM_IO
 //==============================================================================
 #if USE_SD_CRC
 // CRC functions
 //------------------------------------------------------------------------------
+#if USE_SD_CRC == 1
 static uint8_t CRC7(const uint8_t* data, uint8_t n) {
   uint8_t crc = 0;
   for (uint8_t i = 0; i < n; i++) {
@@ -40,6 +62,58 @@ static uint8_t CRC7(const uint8_t* data, uint8_t n) {
   }
   return (crc << 1) | 1;
 }
+#else  // USE_SD_CRC == 1
+// table driven CRC7, x^7 + x^3 + 1.  Entry i is the CRC of the byte i.
+#ifdef __AVR__
+static const uint8_t crc7tab[] PROGMEM = {
+#else  // __AVR__
+static const uint8_t crc7tab[] = {
+#endif  // __AVR__
+  0x00, 0x09, 0x12, 0x1B, 0x24, 0x2D, 0x36, 0x3F,
+  0x48, 0x41, 0x5A, 0x53, 0x6C, 0x65, 0x7E, 0x77,
+  0x19, 0x10, 0x0B, 0x02, 0x3D, 0x34, 0x2F, 0x26,
+  0x51, 0x58, 0x43, 0x4A, 0x75, 0x7C, 0x67, 0x6E,
+  0x32, 0x3B, 0x20, 0x29, 0x16, 0x1F, 0x04, 0x0D,
+  0x7A, 0x73, 0x68, 0x61, 0x5E, 0x57, 0x4C, 0x45,
+  0x2B, 0x22, 0x39, 0x30, 0x0F, 0x06, 0x1D, 0x14,
+  0x63, 0x6A, 0x71, 0x78, 0x47, 0x4E, 0x55, 0x5C,
+  0x64, 0x6D, 0x76, 0x7F, 0x40, 0x49, 0x52, 0x5B,
+  0x2C, 0x25, 0x3E, 0x37, 0x08, 0x01, 0x1A, 0x13,
+  0x7D, 0x74, 0x6F, 0x66, 0x59, 0x50, 0x4B, 0x42,
+  0x35, 0x3C, 0x27, 0x2E, 0x11, 0x18, 0x03, 0x0A,
+  0x56, 0x5F, 0x44, 0x4D, 0x72, 0x7B, 0x60, 0x69,
+  0x1E, 0x17, 0x0C, 0x05, 0x3A, 0x33, 0x28, 0x21,
+  0x4F, 0x46, 0x5D, 0x54, 0x6B, 0x62, 0x79, 0x70,
+  0x07, 0x0E, 0x15, 0x1C, 0x23, 0x2A, 0x31, 0x38,
+  0x41, 0x48, 0x53, 0x5A, 0x65, 0x6C, 0x77, 0x7E,
+  0x09, 0x00, 0x1B, 0x12, 0x2D, 0x24, 0x3F, 0x36,
+  0x58, 0x51, 0x4A, 0x43, 0x7C, 0x75, 0x6E, 0x67,
+  0x10, 0x19, 0x02, 0x0B, 0x34, 0x3D, 0x26, 0x2F,
+  0x73, 0x7A, 0x61, 0x68, 0x57, 0x5E, 0x45, 0x4C,
+  0x3B, 0x32, 0x29, 0x20, 0x1F, 0x16, 0x0D, 0x04,
+  0x6A, 0x63, 0x78, 0x71, 0x4E, 0x47, 0x5C, 0x55,
+  0x22, 0x2B, 0x30, 0x39, 0x06, 0x0F, 0x14, 0x1D,
+  0x25, 0x2C, 0x37, 0x3E, 0x01, 0x08, 0x13, 0x1A,
+  0x6D, 0x64, 0x7F, 0x76, 0x49, 0x40, 0x5B, 0x52,
+  0x3C, 0x35, 0x2E, 0x27, 0x18, 0x11, 0x0A, 0x03,
+  0x74, 0x7D, 0x66, 0x6F, 0x50, 0x59, 0x42, 0x4B,
+  0x17, 0x1E, 0x05, 0x0C, 0x33, 0x3A, 0x21, 0x28,
+  0x5F, 0x56, 0x4D, 0x44, 0x7B, 0x72, 0x69, 0x60,
+  0x0E, 0x07, 0x1C, 0x15, 0x2A, 0x23, 0x38, 0x31,
+  0x46, 0x4F, 0x54, 0x5D, 0x62, 0x6B, 0x70, 0x79
+};
+static uint8_t CRC7(const uint8_t* data, uint8_t n) {
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < n; i++) {
+#ifdef __AVR__
+    crc = pgm_read_byte(&crc7tab[(uint8_t)(crc << 1) ^ data[i]]);
+#else  // __AVR__
+    crc = crc7tab[(uint8_t)(crc << 1) ^ data[i]];
+#endif  // __AVR__
+  }
+  return (crc << 1) | 1;
+}
+#endif  // USE_SD_CRC == 1
 //------------------------------------------------------------------------------
 #if USE_SD_CRC == 1
 // slower CRC-CCITT
@@ -97,23 +171,72 @@ static const uint16_t crctab[] = {
   0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
   0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
 };
-static uint16_t CRC_CCITT(const uint8_t* data, size_t n) {
-  uint16_t crc = 0;
-  for (size_t i = 0; i < n; i++) {
+//------------------------------------------------------------------------------
+// add one byte to a CRC-CCITT
+static inline uint16_t crcUpdate(uint16_t crc, uint8_t b) {
 #ifdef __AVR__
-    crc = pgm_read_word(&crctab[(crc >> 8 ^ data[i]) & 0XFF]) ^ (crc << 8);
+  return pgm_read_word(&crctab[(crc >> 8 ^ b) & 0XFF]) ^ (crc << 8);
 #else  // __AVR__
-    crc = crctab[(crc >> 8 ^ data[i]) & 0XFF] ^ (crc << 8);
+  return crctab[(crc >> 8 ^ b) & 0XFF] ^ (crc << 8);
 #endif  // __AVR__
+}
+//------------------------------------------------------------------------------
+#if USE_SD_CRC > 2 && defined(__AVR__) && SD_SPI_CONFIGURATION < 2
+// Transfer data with AVR hardware SPI and compute its CRC-CCITT.  The table
+// lookup for a byte is done while the next byte is on the bus.  At the full
+// SPI rate a byte takes 16 CPU cycles, enough to hide the lookup.
+#define USE_SPI_CRC_OVERLAP 1
+static uint16_t spiReceiveCrc(uint8_t* buf, size_t n) {
+  uint16_t crc = 0;
+  uint8_t b;
+  SPDR = 0XFF;
+  for (size_t i = 1; i < n; i++) {
+    while (!(SPSR & (1 << SPIF))) {}
+    b = SPDR;
+    SPDR = 0XFF;
+    buf[i - 1] = b;
+    crc = crcUpdate(crc, b);
+  }
+  while (!(SPSR & (1 << SPIF))) {}
+  b = SPDR;
+  buf[n - 1] = b;
+  return crcUpdate(crc, b);
+}
+//------------------------------------------------------------------------------
+static uint16_t spiSendCrc(const uint8_t* buf, size_t n) {
+  uint16_t crc = 0;
+  for (size_t i = 0; i < n; i++) {
+    uint8_t b = buf[i];
+    SPDR = b;
+    crc = crcUpdate(crc, b);
+    while (!(SPSR & (1 << SPIF))) {}
+  }
+  return crc;
+}
+#else  // USE_SD_CRC > 2 && defined(__AVR__) && SD_SPI_CONFIGURATION < 2
+static uint16_t CRC_CCITT(const uint8_t* data, size_t n) {
+  uint16_t crc = 0;
+  for (size_t i = 0; i < n; i++) {
+    crc = crcUpdate(crc, data[i]);
   }
   return crc;
 }
+#endif  // USE_SD_CRC > 2 && defined(__AVR__) && SD_SPI_CONFIGURATION < 2
 #endif  // CRC_CCITT
 #endif  // USE_SD_CRC
 //==============================================================================
 // SdSpiCard member functions
 //------------------------------------------------------------------------------
 bool SdSpiCard::begin(m_spi_t* spi, uint8_t chipSelectPin, uint8_t sckDivisor) {
+#if SD_STREAM_IO
+  // a card left in a multiple block write ignores commands
+  if (m_streamState) {
+    streamStop();
+  }
+#endif  // SD_STREAM_IO
+#if ENABLE_SD_READ_STREAM
+  m_streamEnabled = false;
+#endif  // ENABLE_SD_READ_STREAM
   m_errorCode = m_type = 0;
   m_spi = spi;
   m_chipSelectPin = chipSelectPin;
@@ -140,6 +263,17 @@ bool SdSpiCard::begin(m_spi_t* spi, uint8_t chipSelectPin, uint8_t sckDivisor) {
       error(SD_CARD_ERROR_CMD0);
       goto fail;
     }
+    // A reset of the MCU alone can leave the card in a multiple block
+    // write, where it takes commands as data.  Clock out the rest of any
+    // partial block, then end the write with the stop token.
+    chipSelectLow();
+    for (uint16_t i = 0; i < 514; i++) {
+      spiSend(0XFF);
+    }
+    waitNotBusy(SD_WRITE_TIMEOUT);
+    spiSend(STOP_TRAN_TOKEN);
+    waitNotBusy(SD_WRITE_TIMEOUT);
+    chipSelectHigh();
   }
 #if USE_SD_CRC
   if (cardCommand(CMD59, 1) != R1_IDLE_STATE) {
@@ -191,6 +325,9 @@ bool SdSpiCard::begin(m_spi_t* spi, uint8_t chipSelectPin, uint8_t sckDivisor) {
   }
   chipSelectHigh();
   m_sckDivisor = sckDivisor;
+#if ENABLE_SD_LATENCY_STATS
+  latencyClear();
+#endif  // ENABLE_SD_LATENCY_STATS
   return true;
 
 fail:
@@ -200,11 +337,18 @@ fail:
 //------------------------------------------------------------------------------
 // send command and return error code.  Return zero for OK
 uint8_t SdSpiCard::cardCommand(uint8_t cmd, uint32_t arg) {
+#if SD_STREAM_IO
+  // end an open transfer, the command reports any error
+  if (m_streamState) {
+    streamStop();
+  }
+#endif  // SD_STREAM_IO
   // select card
   chipSelectLow();
 
   // wait if busy
   waitNotBusy(SD_WRITE_TIMEOUT);
+  FULL_LATENCY_START(t0);
 
   uint8_t *pa = reinterpret_cast<uint8_t *>(&arg);
 
@@ -240,6 +384,8 @@ uint8_t SdSpiCard::cardCommand(uint8_t cmd, uint32_t arg) {
   // wait for response
   for (uint8_t i = 0; ((m_status = spiReceive()) & 0X80) && i != 0XFF; i++) {
   }
+  FULL_LATENCY_RECORD(SD_LATENCY_COMMAND, t0,
+                      (m_status & ~R1_IDLE_STATE) == 0);
   return m_status;
 }
 //------------------------------------------------------------------------------
@@ -328,6 +474,12 @@ bool SdSpiCard::eraseSingleBlockEnable() {
 //------------------------------------------------------------------------------
 bool SdSpiCard::isBusy() {
   bool rtn;
+#if ENABLE_SD_READ_STREAM
+  // the card is sending data, not programming
+  if (m_streamState == STREAM_READ) {
+    return false;
+  }
+#endif  // ENABLE_SD_READ_STREAM
   chipSelectLow();
   for (uint8_t i = 0; i < 8; i++) {
     rtn = spiReceive() != 0XFF;
@@ -341,6 +493,12 @@ bool SdSpiCard::isBusy() {
 //------------------------------------------------------------------------------
 bool SdSpiCard::readBlock(uint32_t blockNumber, uint8_t* dst) {
   SD_TRACE("RB", blockNumber);
+#if ENABLE_SD_READ_STREAM
+  if (m_streamEnabled) {
+    return readStream(blockNumber, dst, 1);
+  }
+#endif  // ENABLE_SD_READ_STREAM
+  FULL_LATENCY_START(t0);
   // use address if not SDHC card
   if (type() != SD_CARD_TYPE_SDHC) {
     blockNumber <<= 9;
@@ -349,14 +507,25 @@ bool SdSpiCard::readBlock(uint32_t blockNumber, uint8_t* dst) {
     error(SD_CARD_ERROR_CMD17);
     goto fail;
   }
-  return readData(dst, 512);
+  if (!readData(dst, 512)) {
+    FULL_LATENCY_RECORD(SD_LATENCY_READ_BLOCK, t0, false);
+    return false;
+  }
+  FULL_LATENCY_RECORD(SD_LATENCY_READ_BLOCK, t0, true);
+  return true;
 
 fail:
+  FULL_LATENCY_RECORD(SD_LATENCY_READ_BLOCK, t0, false);
   chipSelectHigh();
   return false;
 }
 //------------------------------------------------------------------------------
 bool SdSpiCard::readBlocks(uint32_t block, uint8_t* dst, size_t count) {
+#if ENABLE_SD_READ_STREAM
+  if (m_streamEnabled) {
+    return readStream(block, dst, count);
+  }
+#endif  // ENABLE_SD_READ_STREAM
   if (!readStart(block)) {
     return false;
   }
@@ -373,10 +542,8 @@ bool SdSpiCard::readData(uint8_t *dst) {
   return readData(dst, 512);
 }
 //------------------------------------------------------------------------------
-bool SdSpiCard::readData(uint8_t* dst, size_t count) {
-#if USE_SD_CRC
+bool SdSpiCard::readData(uint8_t* dst, size_t count, uint16_t* cardCrc) {
   uint16_t crc;
-#endif  // USE_SD_CRC
   // wait for start block token
   uint16_t t0 = millis();
   while ((m_status = spiReceive()) == 0XFF) {
@@ -389,24 +556,33 @@ bool SdSpiCard::readData(uint8_t* dst, size_t count) {
     error(SD_CARD_ERROR_READ);
     goto fail;
   }
+#if USE_SPI_CRC_OVERLAP
+  // transfer data and compute its crc
+  crc = spiReceiveCrc(dst, count);
+  if (crc != ((spiReceive() << 8) | spiReceive())) {
+    error(SD_CARD_ERROR_READ_CRC);
+    goto fail;
+  }
+#else  // USE_SPI_CRC_OVERLAP
   // transfer data
   if ((m_status = spiReceive(dst, count))) {
     error(SD_CARD_ERROR_SPI_DMA);
     goto fail;
   }
 
-#if USE_SD_CRC
   // get crc
-  crc = (spiReceive() << 8) | spiReceive();
+  crc = spiReceive() << 8;
+  crc |= spiReceive();
+#if USE_SD_CRC
   if (crc != CRC_CCITT(dst, count)) {
     error(SD_CARD_ERROR_READ_CRC);
     goto fail;
   }
-#else
-  // discard crc
-  spiReceive();
-  spiReceive();
 #endif  // USE_SD_CRC
+#endif  // USE_SPI_CRC_OVERLAP
+  if (cardCrc) {
+    *cardCrc = crc;
+  }
   chipSelectHigh();
   return true;
 
@@ -459,6 +635,19 @@ bool SdSpiCard::readStart(uint32_t blockNumber) {
   chipSelectHigh();
   return true;
 
+fail:
+  chipSelectHigh();
+  return false;
+}
+//------------------------------------------------------------------------------
+bool SdSpiCard::readStatus(uint8_t* status) {
+  // ACMD13 has an R2 response, second byte must also be zero
+  if (cardAcmd(ACMD13, 0) || spiReceive()) {
+    error(SD_CARD_ERROR_ACMD13);
+    goto fail;
+  }
+  return readData(status, 64);
+
 fail:
   chipSelectHigh();
   return false;
@@ -476,9 +665,117 @@ fail:
   chipSelectHigh();
   return false;
 }
+#if ENABLE_SD_READ_STREAM
+//------------------------------------------------------------------------------
+bool SdSpiCard::readStream(uint32_t block, uint8_t* dst, size_t count) {
+  if (m_streamState != STREAM_READ || block != m_streamBlock) {
+    // readStart() ends the open transfer
+    if (!readStart(block)) {
+      return false;
+    }
+    m_streamState = STREAM_READ;
+  }
+  m_streamBlock = block + count;
+  for (; count; count--, dst += 512) {
+    FULL_LATENCY_START(t0);
+    if (!readData(dst)) {
+      FULL_LATENCY_RECORD(SD_LATENCY_READ_BLOCK, t0, false);
+      streamStop();
+      return false;
+    }
+    FULL_LATENCY_RECORD(SD_LATENCY_READ_BLOCK, t0, true);
+  }
+  return true;
+}
+//------------------------------------------------------------------------------
+bool SdSpiCard::readStreamEnd() {
+  m_streamEnabled = false;
+  return syncBlocks();
+}
+#endif  // ENABLE_SD_READ_STREAM
+#if SD_STREAM_IO
+//------------------------------------------------------------------------------
+bool SdSpiCard::streamStop() {
+  uint8_t state = m_streamState;
+  m_streamState = 0;
+  return state == STREAM_WRITE ? writeStop() : readStop();
+}
+#endif  // SD_STREAM_IO
+//------------------------------------------------------------------------------
+bool SdSpiCard::syncBlocks() {
+#if SD_STREAM_IO
+  if (m_streamState) {
+    return streamStop();
+  }
+#endif  // SD_STREAM_IO
+  return true;
+}
+//------------------------------------------------------------------------------
+// CRC-CCITT of a block a bit at a time, small and built without USE_SD_CRC
+static uint16_t blockCrc(const uint8_t* buf) {
+  uint16_t crc = 0;
+  for (uint16_t i = 0; i < 512; i++) {
+    crc ^= (uint16_t)buf[i] << 8;
+    for (uint8_t k = 0; k < 8; k++) {
+      crc = crc & 0X8000 ? (crc << 1) ^ 0X1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+//------------------------------------------------------------------------------
+// read block zero and check the card's CRC whatever USE_SD_CRC is
+bool SdSpiCard::tuneRead(uint8_t* buf, uint16_t* crc) {
+  uint16_t cardCrc;
+  if (cardCommand(CMD17, 0)) {
+    error(SD_CARD_ERROR_CMD17);
+    goto fail;
+  }
+  if (!readData(buf, 512, &cardCrc)) {
+    return false;
+  }
+  *crc = blockCrc(buf);
+  if (*crc != cardCrc) {
+    error(SD_CARD_ERROR_READ_CRC);
+    return false;
+  }
+  return true;
+
+fail:
+  chipSelectHigh();
+  return false;
+}
+//------------------------------------------------------------------------------
+bool SdSpiCard::tuneSckDivisor(uint8_t* buf) {
+  uint8_t divisor = m_sckDivisor;
+  uint16_t crc;
+  uint16_t crc2;
+  while (true) {
+    m_sckDivisor = divisor;
+    if (tuneRead(buf, &crc) && buf[510] == 0X55 && buf[511] == 0XAA) {
+      if (tuneRead(buf, &crc2) && crc2 == crc) {
+        m_errorCode = 0;
+        return true;
+      }
+    }
+    if (divisor >= SPI_SCK_INIT_DIVISOR) {
+      return false;
+    }
+    divisor <<= 1;
+    if (divisor > SPI_SCK_INIT_DIVISOR) {
+      divisor = SPI_SCK_INIT_DIVISOR;
+    }
+  }
+}
 //------------------------------------------------------------------------------
 // wait for card to go not busy
 bool SdSpiCard::waitNotBusy(uint16_t timeoutMillis) {
+#if ENABLE_SD_LATENCY_STATS
+  // only record waits that found the card busy
+  if (spiReceive() == 0XFF) {
+    return true;
+  }
+#endif  // ENABLE_SD_LATENCY_STATS
+  LATENCY_START(start);
   uint16_t t0 = millis();
   while (spiReceive() != 0XFF) {
     if (((uint16_t)millis() - t0) >= timeoutMillis) {
@@ -486,14 +783,43 @@ bool SdSpiCard::waitNotBusy(uint16_t timeoutMillis) {
     }
     spiYield();
   }
+  // an erase is not a write stall
+  if (timeoutMillis != SD_ERASE_TIMEOUT) {
+    LATENCY_RECORD(SD_LATENCY_BUSY, start, true);
+  }
   return true;
 
 fail:
+  if (timeoutMillis != SD_ERASE_TIMEOUT) {
+    LATENCY_RECORD(SD_LATENCY_BUSY, start, false);
+  }
   return false;
 }
 //------------------------------------------------------------------------------
+#if ENABLE_SD_LATENCY_STATS
+void SdSpiCard::latencyRecord(uint8_t op, uint32_t start, bool ok) {
+  uint32_t t = micros() - start;
+  SdLatency* p = &m_latency[op];
+  uint8_t b = 0;
+  for (uint32_t r = t >> 6; r && b < (SD_LATENCY_BUCKETS - 1); r >>= 1) {
+    b++;
+  }
+  // counts stop at their largest value
+  if (++p->count[b] == 0) {
+    p->count[b]--;
+  }
+  if (!ok && ++p->fail == 0) {
+    p->fail--;
+  }
+  if (t > p->max) {
+    p->max = t;
+  }
+}
+#endif  // ENABLE_SD_LATENCY_STATS
+//------------------------------------------------------------------------------
 bool SdSpiCard::writeBlock(uint32_t blockNumber, const uint8_t* src) {
   SD_TRACE("WB", blockNumber);
+  FULL_LATENCY_START(t0);
   // use address if not SDHC card
   if (type() != SD_CARD_TYPE_SDHC) {
     blockNumber <<= 9;
@@ -521,9 +847,11 @@ bool SdSpiCard::writeBlock(uint32_t blockNumber, const uint8_t* src) {
 #endif  // CHECK_PROGRAMMING
 
   chipSelectHigh();
+  FULL_LATENCY_RECORD(SD_LATENCY_WRITE_BLOCK, t0, true);
   return true;
 
 fail:
+  FULL_LATENCY_RECORD(SD_LATENCY_WRITE_BLOCK, t0, false);
   chipSelectHigh();
   return false;
 }
@@ -541,6 +869,7 @@ bool SdSpiCard::writeBlocks(uint32_t block, const uint8_t* src, size_t count) {
 }
 //------------------------------------------------------------------------------
 bool SdSpiCard::writeData(const uint8_t* src) {
+  LATENCY_START(t0);
   chipSelectLow();
   // wait for previous write to finish
   if (!waitNotBusy(SD_WRITE_TIMEOUT)) {
@@ -550,9 +879,11 @@ bool SdSpiCard::writeData(const uint8_t* src) {
     goto fail;
   }
   chipSelectHigh();
+  LATENCY_RECORD(SD_LATENCY_WRITE_DATA, t0, true);
   return true;
 
 fail:
+  LATENCY_RECORD(SD_LATENCY_WRITE_DATA, t0, false);
   error(SD_CARD_ERROR_WRITE_MULTIPLE);
   chipSelectHigh();
   return false;
@@ -560,6 +891,10 @@ fail:
 //------------------------------------------------------------------------------
 // send one block of data for write block or write multiple blocks
 bool SdSpiCard::writeData(uint8_t token, const uint8_t* src) {
+#if USE_SPI_CRC_OVERLAP
+  spiSend(token);
+  uint16_t crc = spiSendCrc(src, 512);
+#else  // USE_SPI_CRC_OVERLAP
 #if USE_SD_CRC
   uint16_t crc = CRC_CCITT(src, 512);
 #else  // USE_SD_CRC
@@ -567,6 +902,7 @@ bool SdSpiCard::writeData(uint8_t token, const uint8_t* src) {
 #endif  // USE_SD_CRC
   spiSend(token);
   spiSend(src, 512);
+#endif  // USE_SPI_CRC_OVERLAP
   spiSend(crc >> 8);
   spiSend(crc & 0XFF);
 
@@ -584,8 +920,11 @@ fail:
 //------------------------------------------------------------------------------
 bool SdSpiCard::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
   SD_TRACE("WS", blockNumber);
-  // send pre-erase count
-  if (cardAcmd(ACMD23, eraseCount)) {
+  // send pre-erase count, limited to the 23 bits ACMD23 has for it
+  if (eraseCount > 0X7FFFFF) {
+    eraseCount = 0X7FFFFF;
+  }
+  if (eraseCount && cardAcmd(ACMD23, eraseCount)) {
     error(SD_CARD_ERROR_ACMD23);
     goto fail;
   }
@@ -622,3 +961,28 @@ fail:
   chipSelectHigh();
   return false;
 }
+#if ENABLE_SD_WRITE_STREAM
+//------------------------------------------------------------------------------
+bool SdSpiCard::writeStream(uint32_t block, const uint8_t* src, size_t count,
+                            uint32_t eraseCount) {
+  if (m_streamState != STREAM_WRITE || block != m_streamBlock) {
+    // writeStart() ends the open transfer.  The blocks of this call will
+    // be written, the caller may know the run goes further.
+    if (eraseCount < count && count > 1) {
+      eraseCount = count;
+    }
+    if (!writeStart(block, eraseCount)) {
+      return false;
+    }
+    m_streamState = STREAM_WRITE;
+  }
+  m_streamBlock = block + count;
+  for (; count; count--, src += 512) {
+    if (!writeData(src)) {
+      streamStop();
+      return false;
+    }
+  }
+  return true;
+}
+#endif  // ENABLE_SD_WRITE_STREAM
@@ -28,6 +28,57 @@
 #include "SdInfo.h"
 #include "SdSpi.h"
 //==============================================================================
+#if ENABLE_SD_LATENCY_STATS
+/** Number of buckets in a latency histogram.  Bucket zero counts times
+ * under 64 micros, bucket n times from 32 << n to 64 << n micros and the
+ * last bucket all longer times.
+ */
+const uint8_t SD_LATENCY_BUCKETS = 14;
+/** Operations with a latency histogram.  Failed operations are recorded
+ * with their time, a timeout lands in the last bucket, and also counted
+ * in SdLatency::fail.
+ */
+enum {
+  /** waitNotBusy() calls that found the card busy, except erases. */
+  SD_LATENCY_BUSY,
+  /** writeData() of a multiple block write, including the busy wait for
+   * the previous block. */
+  SD_LATENCY_WRITE_DATA,
+#if ENABLE_SD_LATENCY_STATS > 1
+  /** cardCommand() from the end of the busy wait to the response.  An
+   *  error response or no response is a failure. */
+  SD_LATENCY_COMMAND,
+  /** readBlock(). */
+  SD_LATENCY_READ_BLOCK,
+  /** writeBlock(), the card programs the block after it returns. */
+  SD_LATENCY_WRITE_BLOCK,
+#endif  // ENABLE_SD_LATENCY_STATS > 1
+  /** Number of operations. */
+  SD_LATENCY_OPS
+};
+#if ENABLE_SD_LATENCY_STATS > 1
+/** Type of a latency count, stops at its largest value. */
+typedef uint16_t sd_latency_t;
+#else  // ENABLE_SD_LATENCY_STATS > 1
+/** Type of a latency count, stops at its largest value. */
+typedef uint8_t sd_latency_t;
+#endif  // ENABLE_SD_LATENCY_STATS > 1
+/**
+ * \struct SdLatency
+ * \brief Latency histogram of one SD operation.
+ */
+struct SdLatency {
+  /** Operations in each bucket. */
+  sd_latency_t count[SD_LATENCY_BUCKETS];
+  /** Operations that failed or timed out. */
+  sd_latency_t fail;
+  /** Longest time in micros. */
+  uint32_t max;
+};
+#endif  // ENABLE_SD_LATENCY_STATS
+/** SdSpiCard can leave a multiple block transfer open between calls. */
+#define SD_STREAM_IO (ENABLE_SD_READ_STREAM || ENABLE_SD_WRITE_STREAM)
+//==============================================================================
 /**
  * \class SdSpiCard
  * \brief Raw access to SD and SDHC flash memory cards via SPI protocol.
@@ -41,7 +92,11 @@ class SdSpiCard {
   typedef SdSpiBase m_spi_t;
 #endif  // SD_SPI_CONFIGURATION < 3
   /** Construct an instance of SdSpiCard. */
-  SdSpiCard() : m_errorCode(SD_CARD_ERROR_INIT_NOT_CALLED), m_type(0) {}
+  SdSpiCard() : m_errorCode(SD_CARD_ERROR_INIT_NOT_CALLED), m_type(0) {
+#if SD_STREAM_IO
+    m_streamState = 0;
+#endif  // SD_STREAM_IO
+  }
   /** Initialize the SD card.
    * \param[in] spi SPI object.
    * \param[in] chipSelectPin SD chip select pin.
@@ -156,6 +211,15 @@ class SdSpiCard {
    * \return true for success else false.
    */
   bool readOCR(uint32_t* ocr);
+  /** Read the card's SD Status register with ACMD13.
+   *
+   * \param[out] status 64 byte area for the register, most significant
+   * byte first.  The allocation unit size code is the high nibble of
+   * status[10].
+   *
+   * \return true for success else false.
+   */
+  bool readStatus(uint8_t* status);
   /** Start a read multiple blocks sequence.
    *
    * \param[in] blockNumber Address of first block in sequence.
@@ -173,6 +237,24 @@ class SdSpiCard {
    * the value false is returned for failure.
    */
   bool readStop();
+#if ENABLE_SD_READ_STREAM
+  /** Start streaming reads.
+   *
+   * Until readStreamEnd() is called readBlock() and readBlocks() share one
+   * multiple block read for as long as each block requested follows the
+   * last one read.  Reading any other block starts a new multiple block
+   * read.  Any other command stops the open read first.
+   */
+  void readStreamBegin() {
+    m_streamEnabled = true;
+  }
+  /** Stop streaming reads and end any open multiple block read.
+   *
+   * \return The value true is returned for success and
+   * the value false is returned for failure.
+   */
+  bool readStreamEnd();
+#endif  // ENABLE_SD_READ_STREAM
   /** Return SCK divisor.
    *
    * \return Requested SCK divisor.
@@ -180,6 +262,37 @@ class SdSpiCard {
   uint8_t sckDivisor() {
     return m_sckDivisor;
   }
+  /** End a multiple block transfer left open by streaming reads or
+   * writeStream().  Data written with writeStream() is programmed when
+   * this returns.
+   *
+   * \return The value true is returned for success and
+   * the value false is returned for failure.
+   */
+  bool syncBlocks();
+  /** Set the SCK divisor used after begin().
+   *
+   * \param[in] sckDivisor SCK divisor, for example a value
+   * found earlier by tuneSckDivisor().
+   */
+  void setSckDivisor(uint8_t sckDivisor) {
+    m_sckDivisor = sckDivisor;
+  }
+  /** Find the fastest SCK divisor the card can be read at reliably.
+   *
+   * Starting with the current divisor, block zero is read twice at each
+   * speed.  A speed passes if both reads succeed, the card's CRC matches
+   * the data of both reads, the block has the 0X55, 0XAA boot signature
+   * and both reads return the same data.  The CRC is checked with or
+   * without USE_SD_CRC.  The divisor is doubled until a speed passes or
+   * SPI_SCK_INIT_DIVISOR is reached.
+   *
+   * \param[out] buf 512 byte scratch area.
+   *
+   * \return true if a reliable divisor was found.  The divisor is left
+   * set and can be read with sckDivisor().
+   */
+  bool tuneSckDivisor(uint8_t* buf);
   /** Return the card type: SD V1, SD V2 or SDHC
    * \return 0 - SD V1, 1 - SD V2, or 3 - SDHC.
    */
@@ -214,7 +327,9 @@ class SdSpiCard {
   /** Start a write multiple blocks sequence.
    *
    * \param[in] blockNumber Address of first block in sequence.
-   * \param[in] eraseCount The number of blocks to be pre-erased.
+   * \param[in] eraseCount The number of blocks to be pre-erased.  This
+   * should be the number of blocks that will be written.  Zero sends no
+   * pre-erase count.
    *
    * \note This function is used with writeData() and writeStop()
    * for optimized multiple block writes.
@@ -229,6 +344,41 @@ class SdSpiCard {
    * the value false is returned for failure.
    */
   bool writeStop();
+#if ENABLE_SD_WRITE_STREAM
+  /** Write blocks and leave the multiple block write open.
+   *
+   * A following call that starts at the next block continues the same
+   * write sequence without a command.  A write to any other block starts a
+   * new sequence.  Reads, other commands and syncBlocks() end it.
+   *
+   * \param[in] block Logical block to be written.
+   * \param[in] src Pointer to the location of the data to be written.
+   * \param[in] count Number of blocks to be written.
+   * \param[in] eraseCount Pre-erase count sent if a new sequence starts.
+   * Blocks after those written that are pre-erased but not written before
+   * the sequence ends lose their data.  Zero sends no pre-erase count.
+   *
+   * \return The value true is returned for success and
+   * the value false is returned for failure.
+   */
+  bool writeStream(uint32_t block, const uint8_t* src, size_t count,
+                   uint32_t eraseCount = 0);
+#endif  // ENABLE_SD_WRITE_STREAM
+#if ENABLE_SD_LATENCY_STATS
+  /** Latency histogram of an operation since begin() or latencyClear().
+   *
+   * \param[in] op Operation, less than SD_LATENCY_OPS.
+   *
+   * \return Pointer to the histogram.
+   */
+  const SdLatency* latency(uint8_t op) const {
+    return &m_latency[op];
+  }
+  /** Clear all latency histograms. */
+  void latencyClear() {
+    memset(m_latency, 0, sizeof(m_latency));
+  }
+#endif  // ENABLE_SD_LATENCY_STATS
 
  private:
   // private functions
@@ -237,8 +387,15 @@ class SdSpiCard {
     return cardCommand(cmd, arg);
   }
   uint8_t cardCommand(uint8_t cmd, uint32_t arg);
-  bool readData(uint8_t* dst, size_t count);
+  bool readData(uint8_t* dst, size_t count, uint16_t* cardCrc = 0);
   bool readRegister(uint8_t cmd, void* buf);
+  bool tuneRead(uint8_t* buf, uint16_t* crc);
+#if ENABLE_SD_READ_STREAM
+  bool readStream(uint32_t block, uint8_t* dst, size_t count);
+#endif  // ENABLE_SD_READ_STREAM
+#if SD_STREAM_IO
+  bool streamStop();
+#endif  // SD_STREAM_IO
   void chipSelectHigh();
   void chipSelectLow();
   void spiYield();
@@ -274,6 +431,17 @@ class SdSpiCard {
   uint8_t m_sckDivisor;
   uint8_t m_status;
   uint8_t m_type;
+#if ENABLE_SD_READ_STREAM
+  bool m_streamEnabled;
+#endif  // ENABLE_SD_READ_STREAM
+#if SD_STREAM_IO
+  uint8_t m_streamState;   // open multiple block transfer, if any
+  uint32_t m_streamBlock;  // next block of the open transfer
+#endif  // SD_STREAM_IO
+#if ENABLE_SD_LATENCY_STATS
+  void latencyRecord(uint8_t op, uint32_t start, bool ok);
+  SdLatency m_latency[SD_LATENCY_OPS];
+#endif  // ENABLE_SD_LATENCY_STATS
 };
 //==============================================================================
 /**
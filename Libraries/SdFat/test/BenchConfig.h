@@ -0,0 +1,18 @@
+/*
+ * Configuration overrides for the host benchmarks.
+ *
+ * Force included with g++ -include so every FatLib source is built
+ * with the same settings.  SdFatConfig.h is read first, its include
+ * guard then keeps these values.
+ */
+#include "../src/SdFatConfig.h"
+
+#ifdef BENCH_CACHE_BLOCKS
+#undef FAT_CACHE_BLOCKS
+#define FAT_CACHE_BLOCKS BENCH_CACHE_BLOCKS
+#endif  // BENCH_CACHE_BLOCKS
+
+#ifdef BENCH_SCAN_STREAM
+#undef USE_FAT_SCAN_STREAM
+#define USE_FAT_SCAN_STREAM BENCH_SCAN_STREAM
+#endif  // BENCH_SCAN_STREAM
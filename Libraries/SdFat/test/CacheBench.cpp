@@ -0,0 +1,91 @@
+/*
+ * Block reads of metadata heavy work for each FAT_CACHE_BLOCKS size.
+ *
+ * 200 LOGnnnnn.TXT files are made on a blank 64MB FAT32 volume with
+ * one block clusters, or on the image file given as an argument.
+ * Three workloads are then counted:
+ *
+ *   probe        open LOG00000.TXT, LOG00001.TXT, .. until one is
+ *                missing, the way newLog() used to search
+ *   list+open    walk the directory, open each file, read its first
+ *                bytes and seek to its end
+ *   remove half  remove every other file by name
+ *
+ * Build and run it once per cache size:
+ *
+ *   for n in 1 2 4 8; do
+ *     g++ -I../src -I../src/FatLib -include BenchConfig.h \
+ *       -DBENCH_CACHE_BLOCKS=$n -o CacheBench CacheBench.cpp \
+ *       ../src/FatLib/FatVolume.cpp ../src/FatLib/FatFile.cpp \
+ *       ../src/FatLib/FatFileLFN.cpp ../src/FatLib/FatFileSFN.cpp \
+ *       ../src/FatLib/FatFileExFat.cpp ../src/FatLib/FatFilePrint.cpp \
+ *       ../src/FatLib/FmtNumber.cpp &&
+ *     ./CacheBench
+ *   done
+ */
+#include "RamVolume.h"
+
+RamVolume vol;
+//------------------------------------------------------------------------------
+static void fail(const char* msg) {
+  printf("error: %s\n", msg);
+  exit(1);
+}
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+  char name[16];
+  uint8_t buf[300];
+  FatFile file;
+
+  if (argc > 1 ? !vol.load(argv[1]) : !vol.format(64, 1, 32)) {
+    fail("image");
+  }
+  if (!vol.begin()) {
+    fail("begin");
+  }
+  FatFile::setCwd(vol.vwd());
+  memset(buf, 'x', sizeof(buf));
+  for (int i = 0; i < 200; i++) {
+    sprintf(name, "LOG%05d.TXT", i);
+    if (!file.open(name, O_CREAT | O_EXCL | O_WRITE)
+        || file.write(buf, 100 + i) != 100 + i || !file.close()) {
+      fail("create");
+    }
+  }
+
+  vol.clearStats();
+  for (int i = 0; ; i++) {
+    sprintf(name, "LOG%05d.TXT", i);
+    if (!file.open(name, O_READ)) {
+      break;
+    }
+    file.close();
+  }
+  unsigned long probe = vol.stats.reads;
+
+  vol.clearStats();
+  FatFile dir;
+  if (!dir.open("/", O_READ)) {
+    fail("open root");
+  }
+  while (file.openNext(&dir, O_READ)) {
+    file.read(buf, 10);
+    file.seekEnd();
+    file.close();
+  }
+  dir.close();
+  unsigned long list = vol.stats.reads;
+
+  vol.clearStats();
+  for (int i = 0; i < 200; i += 2) {
+    sprintf(name, "LOG%05d.TXT", i);
+    if (!vol.remove(name)) {
+      fail("remove");
+    }
+  }
+  unsigned long rm = vol.stats.reads;
+
+  printf("FAT_CACHE_BLOCKS %d, block reads: probe %lu, list+open %lu, "
+         "remove half %lu\n", FAT_CACHE_BLOCKS, probe, list, rm);
+  return 0;
+}
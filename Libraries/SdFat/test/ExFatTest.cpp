@@ -0,0 +1,462 @@
+/*
+ * exFAT read and append tests.
+ *
+ * Files are made, appended, truncated and removed on blank exFAT
+ * volumes built by RamVolume::formatExFat(), then the image is checked
+ * the way fsck.exfat would: entry set checksums and name hashes, cluster
+ * chains, NoFatChain runs and the allocation bitmap.  An image file
+ * given as an argument, for example one made by mkfs.exfat, is checked,
+ * listed and used for the append test too.
+ *
+ *   g++ -I../src -I../src/FatLib -include BenchConfig.h \
+ *     -o ExFatTest ExFatTest.cpp \
+ *     ../src/FatLib/FatVolume.cpp ../src/FatLib/FatFile.cpp \
+ *     ../src/FatLib/FatFileLFN.cpp ../src/FatLib/FatFileSFN.cpp \
+ *     ../src/FatLib/FatFileExFat.cpp ../src/FatLib/FatFilePrint.cpp \
+ *     ../src/FatLib/FmtNumber.cpp &&
+ *   ./ExFatTest [image]
+ */
+#include "RamVolume.h"
+
+RamVolume vol;
+//------------------------------------------------------------------------------
+static void fail(const char* msg) {
+  printf("error: %s\n", msg);
+  exit(1);
+}
+//------------------------------------------------------------------------------
+static uint8_t pattern(uint32_t pos, uint8_t seed) {
+  return (pos*7 + pos/511 + seed) & 0XFF;
+}
+//------------------------------------------------------------------------------
+// Append n bytes of pattern seed to a file, in writes of up to chunk bytes.
+static void append(const char* name, uint32_t n, uint32_t chunk,
+                   uint8_t seed) {
+  static uint8_t buf[1 << 20];
+  FatFile file;
+  if (!file.open(name, O_CREAT | O_WRITE | O_APPEND)) {
+    fail("open for append");
+  }
+  uint32_t pos = file.fileSize();
+  for (uint32_t i = 0; i < n; i++) {
+    buf[i] = pattern(pos + i, seed);
+  }
+  for (uint32_t i = 0; i < n; i += chunk) {
+    uint32_t m = n - i < chunk ? n - i : chunk;
+    if (file.write(buf + i, m) != (int)m) {
+      fail("write");
+    }
+  }
+  if (!file.close()) {
+    fail("close");
+  }
+}
+//------------------------------------------------------------------------------
+// Read a file and check its size and pattern.
+static void verify(const char* name, uint32_t size, uint8_t seed) {
+  static uint8_t buf[1 << 20];
+  FatFile file;
+  if (!file.open(name, O_READ)) {
+    fail("open for read");
+  }
+  if (file.fileSize() != size || file.read(buf, sizeof(buf)) != (int)size) {
+    fail("size");
+  }
+  for (uint32_t i = 0; i < size; i++) {
+    if (buf[i] != pattern(i, seed)) {
+      printf("%s offset %u\n", name, (unsigned)i);
+      fail("data");
+    }
+  }
+  // seek into the middle of the file
+  if (size > 1000) {
+    if (!file.seekSet(size - 1000) || file.read(buf, 1) != 1
+        || buf[0] != pattern(size - 1000, seed)) {
+      fail("seek");
+    }
+  }
+  file.close();
+}
+static void mount();
+//==============================================================================
+// Image checker, independent of FatLib.
+static uint32_t u32(size_t offset) {
+  uint32_t v;
+  memcpy(&v, &vol.image[offset], 4);
+  return v;
+}
+static uint64_t u64(size_t offset) {
+  uint64_t v;
+  memcpy(&v, &vol.image[offset], 8);
+  return v;
+}
+static uint32_t heap;
+static uint8_t shift;
+static uint32_t clusterCount;
+static uint32_t fatStart;
+static std::vector<uint8_t> used;
+//------------------------------------------------------------------------------
+static size_t clusterAt(uint32_t c) {
+  return (heap + ((size_t)(c - 2) << shift))*512;
+}
+//------------------------------------------------------------------------------
+static void use(uint32_t c) {
+  if (c < 2 || c > clusterCount + 1 || used[c]) {
+    printf("cluster %u\n", (unsigned)c);
+    fail("cluster out of range or cross-linked");
+  }
+  used[c] = 1;
+}
+//------------------------------------------------------------------------------
+// Mark the clusters of a chain or run and return them in order.  The
+// count must match size unless size is zero for a FAT chain.
+static std::vector<uint32_t> chain(uint32_t first, uint64_t size,
+                                   bool noFatChain) {
+  std::vector<uint32_t> v;
+  uint64_t n = (size + (512ULL << shift) - 1) >> (shift + 9);
+  if (first == 0) {
+    if (size) {
+      fail("data without clusters");
+    }
+    return v;
+  }
+  for (uint32_t c = first; ; ) {
+    use(c);
+    v.push_back(c);
+    if (noFatChain) {
+      if (v.size() >= n) {
+        break;
+      }
+      c++;
+    } else {
+      c = u32(fatStart*512 + 4*c);
+      if (c == 0XFFFFFFFF) {
+        break;
+      }
+    }
+  }
+  if (size && v.size() != n) {
+    fail("cluster count doesn't match size");
+  }
+  return v;
+}
+//------------------------------------------------------------------------------
+static std::vector<uint32_t> bitmap;
+// Check the entry sets of a directory and the clusters of its files.
+static void checkDir(const std::vector<uint32_t>& dir, uint32_t* nFile) {
+  uint32_t perCluster = 16 << shift;
+  uint32_t nEntry = dir.size()*perCluster;
+  for (uint32_t i = 0; i < nEntry; i++) {
+    size_t e = clusterAt(dir[i/perCluster]) + 32*(i % perCluster);
+    uint8_t type = vol.image[e];
+    if (type == 0) {
+      break;
+    }
+    if (type == EXFAT_TYPE_BITMAP) {
+      bitmap = chain(u32(e + 20), u64(e + 24), false);
+      continue;
+    }
+    if (type == EXFAT_TYPE_UPCASE) {
+      chain(u32(e + 20), u64(e + 24), false);
+      continue;
+    }
+    if (type != EXFAT_TYPE_FILE) {
+      continue;
+    }
+    uint8_t count = vol.image[e + 1];
+    uint16_t sum = 0;
+    if (count < 2 || i + count >= nEntry) {
+      fail("entry set count");
+    }
+    for (uint32_t j = 0; j <= count; j++) {
+      uint32_t k = i + j;
+      size_t ej = clusterAt(dir[k/perCluster]) + 32*(k % perCluster);
+      if (j && vol.image[ej] != (j == 1 ? EXFAT_TYPE_STREAM : EXFAT_TYPE_NAME)) {
+        fail("entry set type");
+      }
+      for (uint8_t b = 0; b < 32; b++) {
+        if (j || b < 2 || b > 3) {
+          sum = ((sum & 1) ? 0X8000 : 0) + (sum >> 1) + vol.image[ej + b];
+        }
+      }
+    }
+    if (sum != (vol.image[e + 2] | vol.image[e + 3] << 8)) {
+      fail("set checksum");
+    }
+    size_t se = clusterAt(dir[(i + 1)/perCluster]) + 32*((i + 1) % perCluster);
+    uint8_t nameLength = vol.image[se + 3];
+    uint16_t hash = 0;
+    if (nameLength == 0 || (nameLength + 14)/15 != count - 1) {
+      fail("name length");
+    }
+    for (uint8_t k = 0; k < nameLength; k++) {
+      uint32_t j = i + 2 + k/15;
+      size_t ne = clusterAt(dir[j/perCluster]) + 32*(j % perCluster);
+      uint16_t c = vol.image[ne + 2 + 2*(k % 15)]
+                   | vol.image[ne + 3 + 2*(k % 15)] << 8;
+      if ('a' <= c && c <= 'z') {
+        c -= 'a' - 'A';
+      }
+      hash = ((hash & 1) ? 0X8000 : 0) + (hash >> 1) + (c & 0XFF);
+      hash = ((hash & 1) ? 0X8000 : 0) + (hash >> 1) + (c >> 8);
+    }
+    if (hash != (vol.image[se + 4] | vol.image[se + 5] << 8)) {
+      fail("name hash");
+    }
+    if (u64(se + 8) > u64(se + 24)) {
+      fail("valid data length");
+    }
+    std::vector<uint32_t> v = chain(u32(se + 20), u64(se + 24),
+                                    vol.image[se + 1] & EXFAT_FLAG_NO_FAT_CHAIN);
+    if (vol.image[e + 4] & DIR_ATT_DIRECTORY) {
+      checkDir(v, nFile);
+    } else {
+      (*nFile)++;
+    }
+    i += count;
+  }
+}
+//------------------------------------------------------------------------------
+// Check the image and return the number of free clusters.
+static uint32_t check(uint32_t* nFile) {
+  uint32_t nFree = 0;
+  fatStart = u32(80);
+  heap = u32(88);
+  clusterCount = u32(92);
+  shift = vol.image[109];
+  used.assign(clusterCount + 2, 0);
+  bitmap.clear();
+  *nFile = 0;
+  checkDir(chain(u32(96), 0, false), nFile);
+  if (bitmap.empty()) {
+    fail("no bitmap");
+  }
+  for (uint32_t c = 2; c < clusterCount + 2; c++) {
+    uint32_t i = (c - 2)/8;
+    size_t b = clusterAt(bitmap[i >> (shift + 9)]) + (i & ((512 << shift) - 1));
+    bool bit = (vol.image[b] >> ((c - 2) % 8)) & 1;
+    if (bit != used[c]) {
+      printf("cluster %u bitmap %d used %d\n", (unsigned)c, bit, used[c]);
+      fail("bitmap");
+    }
+    nFree += !bit;
+  }
+  return nFree;
+}
+//------------------------------------------------------------------------------
+// Check the image and the free count FatLib reports.
+static void checkVolume(const char* step) {
+  uint32_t nFile;
+  uint32_t nFree = check(&nFile);
+  if (vol.vol()->freeClusterCount() != (int32_t)nFree) {
+    printf("%s: free %u, freeClusterCount %d\n", step, (unsigned)nFree,
+           (int)vol.vol()->freeClusterCount());
+    fail("free count");
+  }
+  printf("%s: %u files, %u clusters free, ok\n", step, (unsigned)nFile,
+         (unsigned)nFree);
+}
+//------------------------------------------------------------------------------
+// FatLib doesn't make exFAT directories.  Make a file of one zeroed
+// cluster, then set its directory attribute in the image and remount.
+static void makeDir(const char* name) {
+  static uint8_t zero[1 << 17];
+  uint32_t nFile;
+  FatFile file;
+  if (!file.open(name, O_CREAT | O_EXCL | O_WRITE)
+      || file.write(zero, 512UL << vol.vol()->clusterSizeShift()) < 0
+      || !file.close() || !file.open(name, O_READ)) {
+    fail("makeDir");
+  }
+  uint32_t first = file.firstCluster();
+  file.close();
+  check(&nFile);
+  for (uint32_t c = u32(96); c != 0XFFFFFFFF; c = u32(fatStart*512 + 4*c)) {
+    for (uint32_t i = 0; i + 2 < (16UL << shift); i++) {
+      size_t e = clusterAt(c) + 32*i;
+      if (vol.image[e] != EXFAT_TYPE_FILE || u32(e + 52) != first) {
+        continue;
+      }
+      uint16_t sum = 0;
+      vol.image[e + 4] = DIR_ATT_DIRECTORY;
+      for (uint32_t j = 0; j < 32UL*(vol.image[e + 1] + 1); j++) {
+        if (j < 2 || j > 3) {
+          sum = ((sum & 1) ? 0X8000 : 0) + (sum >> 1) + vol.image[e + j];
+        }
+      }
+      memcpy(&vol.image[e + 2], &sum, 2);
+      mount();
+      return;
+    }
+  }
+  fail("makeDir entry");
+}
+//------------------------------------------------------------------------------
+static void mount() {
+  if (!vol.begin() || vol.fatType() != 64) {
+    fail("begin");
+  }
+  FatFile::setCwd(vol.vwd());
+}
+//==============================================================================
+static void listImage() {
+  FatFile dir;
+  FatFile file;
+  char name[64];
+  if (!dir.openRoot(vol.vol())) {
+    fail("open root");
+  }
+  while (file.openNext(&dir, O_READ)) {
+    file.getName(name, sizeof(name));
+    printf("  %s %u\n", name, (unsigned)file.fileSize());
+    file.close();
+  }
+  if (dir.getError()) {
+    fail("list");
+  }
+}
+//------------------------------------------------------------------------------
+// Write tests, on a volume with clusters of 1 << clusterShift blocks.
+static void writeTests(uint8_t clusterShift) {
+  uint32_t cs = 512UL << clusterShift;
+  uint32_t chunk = clusterShift ? 1000 : 700;
+  char name[40];
+  FatFile file;
+
+  // contiguous file, single and multiple block writes
+  append("Contiguous.bin", 3*cs + 100, chunk, 1);
+  append("Contiguous.bin", 2*cs, 2*cs, 1);
+  verify("Contiguous.bin", 5*cs + 100, 1);
+  checkVolume("contiguous");
+
+  // fragment a file, its clusters move to a FAT chain
+  append("A.TXT", cs, chunk, 2);
+  append("B.TXT", cs, chunk, 3);
+  append("A.TXT", cs + 10, chunk, 2);
+  verify("A.TXT", 2*cs + 10, 2);
+  verify("B.TXT", cs, 3);
+  checkVolume("fragmented");
+
+  // truncate both kinds
+  if (!file.open("A.TXT", O_WRITE) || !file.truncate(cs - 5) || !file.close()
+      || !file.open("Contiguous.bin", O_WRITE) || !file.truncate(cs + 1)
+      || !file.close()) {
+    fail("truncate");
+  }
+  verify("A.TXT", cs - 5, 2);
+  verify("Contiguous.bin", cs + 1, 1);
+  checkVolume("truncate");
+
+  // O_TRUNC and case insensitive open
+  if (!file.open("b.txt", O_WRITE | O_TRUNC) || !file.close()) {
+    fail("O_TRUNC");
+  }
+  verify("B.TXT", 0, 3);
+  append("b.TXT", 1000, chunk, 3);
+  verify("B.txt", 1000, 3);
+  if (file.open("B.TXT", O_CREAT | O_EXCL | O_WRITE)) {
+    fail("O_EXCL");
+  }
+  checkVolume("O_TRUNC");
+
+  // enough files to grow the root directory
+  for (int i = 0; i < 100; i++) {
+    sprintf(name, "LOG%05d.TXT", i);
+    append(name, 100 + i, chunk, i);
+  }
+  for (int i = 0; i < 100; i++) {
+    sprintf(name, "LOG%05d.TXT", i);
+    verify(name, 100 + i, i);
+  }
+  checkVolume("root growth");
+
+  // 8.3 names and readDir()
+  FatFile root;
+  dir_t d;
+  int n = 0;
+  append("Long File Name.text", 10, chunk, 4);
+  if (!root.openRoot(vol.vol())) {
+    fail("open root");
+  }
+  while (root.readDir(&d) > 0) {
+    FatFile::dirName(&d, name);
+    if (!strcmp(name, "LONGFI~1.TEX") && d.fileSize == 10) {
+      n++;
+    }
+    if (!strcmp(name, "A.TXT") && d.fileSize == cs - 5) {
+      n++;
+    }
+  }
+  root.close();
+  if (n != 2) {
+    fail("readDir");
+  }
+  // remove, name and by pattern
+  if (!vol.remove("Contiguous.bin") || vol.exists("CONTIGUOUS.BIN")) {
+    fail("remove");
+  }
+  checkVolume("remove");
+
+  // a remount reads the same files
+  mount();
+  verify("A.TXT", cs - 5, 2);
+  for (int i = 0; i < 100; i += 10) {
+    sprintf(name, "LOG%05d.TXT", i);
+    verify(name, 100 + i, i);
+  }
+  checkVolume("remount");
+
+  // directory changes fail
+  if (vol.mkdir("DIR") || vol.rename("A.TXT", "C.TXT")) {
+    fail("directory change");
+  }
+
+  // files in a NoFatChain directory, enough to grow it
+  makeDir("Sub Dir");
+  append("Sub Dir/First.txt", cs + 1, chunk, 6);
+  for (int i = 0; i < 60; i++) {
+    sprintf(name, "sub dir/LOG%05d.TXT", i);
+    append(name, 10 + i, chunk, i);
+  }
+  append("Sub Dir/First.txt", 100, chunk, 6);
+  verify("SUB DIR/FIRST.TXT", cs + 101, 6);
+  for (int i = 0; i < 60; i += 7) {
+    sprintf(name, "Sub Dir/LOG%05d.TXT", i);
+    verify(name, 10 + i, i);
+  }
+  checkVolume("subdirectory");
+  mount();
+  verify("Sub Dir/LOG00059.TXT", 69, 59);
+  if (!vol.chdir("Sub Dir") || !vol.remove("First.txt")
+      || vol.exists("First.txt") || !vol.chdir("/")) {
+    fail("remove in subdirectory");
+  }
+  checkVolume("remount");
+}
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    if (!vol.load(argv[1])) {
+      fail("image");
+    }
+    mount();
+    checkVolume(argv[1]);
+    listImage();
+    append("ExFatTest.bin", 100000, 1000, 5);
+    verify("ExFatTest.bin", 100000, 5);
+    checkVolume("append");
+    return 0;
+  }
+  // 4 KB and 128 KB clusters
+  const uint8_t shifts[] = {3, 8};
+  for (uint8_t i = 0; i < sizeof(shifts); i++) {
+    printf("%u KB clusters\n", 1 << (shifts[i] - 1));
+    if (!vol.formatExFat(64, shifts[i])) {
+      fail("format");
+    }
+    mount();
+    checkVolume("blank");
+    writeTests(shifts[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,110 @@
+/*
+ * Read commands for FAT scans with and without USE_FAT_SCAN_STREAM.
+ *
+ * A blank 512MB FAT32 volume with one block clusters, about a million
+ * clusters and 8192 FAT blocks, or the image file given as an argument,
+ * is filled to three quarters by one contiguous file.  The FSINFO free
+ * count and next free hint are then cleared, as a host that doesn't keep
+ * them leaves a card.  Each workload starts from a new mount:
+ *
+ *   count       freeClusterCount()
+ *   first       create a file and write its first cluster, the
+ *               allocation search starts at cluster two
+ *   contiguous  createContiguous() of 1MB
+ *
+ * Build and run it with and without streaming:
+ *
+ *   for s in 0 1; do
+ *     g++ -I../src -I../src/FatLib -include BenchConfig.h \
+ *       -DBENCH_SCAN_STREAM=$s -o FatScanBench FatScanBench.cpp \
+ *       ../src/FatLib/FatVolume.cpp ../src/FatLib/FatFile.cpp \
+ *       ../src/FatLib/FatFileLFN.cpp ../src/FatLib/FatFileSFN.cpp \
+ *       ../src/FatLib/FatFileExFat.cpp ../src/FatLib/FatFilePrint.cpp \
+ *       ../src/FatLib/FmtNumber.cpp &&
+ *     ./FatScanBench
+ *   done
+ */
+#include "RamVolume.h"
+
+RamVolume vol;
+//------------------------------------------------------------------------------
+static void fail(const char* msg) {
+  printf("error: %s\n", msg);
+  exit(1);
+}
+//------------------------------------------------------------------------------
+// Clear the FSINFO hints and mount the volume again.
+static void remount() {
+  fat32_boot_t* pb = reinterpret_cast<fat32_boot_t*>(&vol.image[0]);
+  if (vol.fatType() == 32 && pb->fat32FSInfo) {
+    fat32_fsinfo_t* pf =
+      reinterpret_cast<fat32_fsinfo_t*>(&vol.image[512*pb->fat32FSInfo]);
+    pf->freeCount = 0XFFFFFFFF;
+    pf->nextFree = 0XFFFFFFFF;
+  }
+  if (!vol.begin()) {
+    fail("begin");
+  }
+  FatFile::setCwd(vol.vwd());
+  vol.clearStats();
+}
+//------------------------------------------------------------------------------
+static void print(const char* name) {
+  printf("  %-10s %6lu read commands %6lu blocks read\n",
+         name, vol.stats.readCmds, vol.stats.reads);
+}
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+  uint8_t buf[512];
+  FatFile file;
+
+  if (argc > 1 ? !vol.load(argv[1]) : !vol.format(512, 1, 32)) {
+    fail("image");
+  }
+  if (!vol.begin()) {
+    fail("begin");
+  }
+  FatFile::setCwd(vol.vwd());
+  uint32_t clusters = vol.clusterCount();
+  uint32_t fill = 3*(clusters/4);
+  uint32_t clusterBytes = 512UL*vol.blocksPerCluster();
+  if (fill > 0XFFFFFFFF/clusterBytes) {
+    fill = 0XFFFFFFFF/clusterBytes;
+  }
+  if (!file.createContiguous(vol.vwd(), "FILL.BIN", fill*clusterBytes)
+      || !file.close()) {
+    fail("fill");
+  }
+  printf("USE_FAT_SCAN_STREAM %d, FAT%d, %lu clusters, %lu FAT blocks\n",
+         USE_FAT_SCAN_STREAM, vol.fatType(), (unsigned long)clusters,
+         (unsigned long)vol.blocksPerFat());
+
+  remount();
+  int32_t free = vol.freeClusterCount();
+  if (free < 0) {
+    fail("count");
+  }
+  print("count");
+
+  remount();
+  memset(buf, 'x', sizeof(buf));
+  if (!file.open("FIRST.TXT", O_CREAT | O_EXCL | O_WRITE)
+      || file.write(buf, sizeof(buf)) != sizeof(buf) || !file.close()) {
+    fail("first");
+  }
+  print("first");
+
+  remount();
+  if (!file.createContiguous(vol.vwd(), "CONTIG.BIN", 1UL << 20)
+      || !file.close()) {
+    fail("contiguous");
+  }
+  print("contiguous");
+
+  remount();
+  int32_t used = 1 + (1UL << 20)/clusterBytes;
+  if (vol.freeClusterCount() != free - used) {
+    fail("free count after allocation");
+  }
+  return 0;
+}
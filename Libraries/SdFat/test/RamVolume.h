@@ -0,0 +1,328 @@
+/*
+ * FAT volume in a RAM image, for host benchmarks of FatLib.
+ *
+ * RamVolume is a FatFileSystem whose block device is a byte vector.
+ * It counts blocks moved and the commands an SD card would have seen,
+ * so code paths can be compared without hardware.  An image is either
+ * loaded from a file, for example one made by mkfs.vfat, or built
+ * blank in memory by format() or formatExFat().
+ *
+ * The Arduino IDE doesn't compile this folder.  See the benchmarks
+ * next to this file for build lines.
+ */
+#ifndef RamVolume_h
+#define RamVolume_h
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "FatFileSystem.h"
+//------------------------------------------------------------------------------
+/** Block device counts. */
+struct RamStats {
+  /** Blocks read. */
+  unsigned long reads;
+  /** Read commands, a multiple block or streamed read counts once. */
+  unsigned long readCmds;
+  /** Blocks written. */
+  unsigned long writes;
+  /** Write commands, a multiple block write counts once. */
+  unsigned long writeCmds;
+};
+//------------------------------------------------------------------------------
+class RamVolume : public FatFileSystem {
+ public:
+  RamVolume() : m_streamOpen(false) {
+    clearStats();
+  }
+  /** Zero the counts. */
+  void clearStats() {
+    memset(&stats, 0, sizeof(stats));
+  }
+  /** Build a blank volume.
+   * \param[in] mb Size in MB.
+   * \param[in] blocksPerCluster Cluster size in blocks.
+   * \param[in] fatType 16 or 32.
+   * \return true for success else false.
+   */
+  bool format(uint32_t mb, uint8_t blocksPerCluster, uint8_t fatType) {
+    uint32_t total = mb << 11;
+    uint16_t reserved = fatType == 16 ? 1 : 32;
+    uint16_t rootEntries = fatType == 16 ? 512 : 0;
+    uint32_t rootBlocks = rootEntries/16;
+    uint32_t entriesPerBlock = fatType == 16 ? 256 : 128;
+    uint32_t fatBlocks = 1;
+    uint32_t clusters;
+    // grow the FAT until it maps every cluster left after it
+    while (1) {
+      clusters = (total - reserved - 2*fatBlocks - rootBlocks)/blocksPerCluster;
+      uint32_t need = (clusters + 2 + entriesPerBlock - 1)/entriesPerBlock;
+      if (need <= fatBlocks) {
+        break;
+      }
+      fatBlocks = need;
+    }
+    if (fatType == 16 ? clusters < 4085 || clusters > 65524 : clusters < 65525) {
+      return false;
+    }
+    image.assign(total*512, 0);
+    fat_boot_t* pb = reinterpret_cast<fat_boot_t*>(&image[0]);
+    pb->jump[0] = 0XEB;
+    pb->jump[1] = 0X58;
+    pb->jump[2] = 0X90;
+    memcpy(pb->oemId, "MSWIN4.1", 8);
+    pb->bytesPerSector = 512;
+    pb->sectorsPerCluster = blocksPerCluster;
+    pb->reservedSectorCount = reserved;
+    pb->fatCount = 2;
+    pb->rootDirEntryCount = rootEntries;
+    pb->mediaType = 0XF8;
+    pb->sectorsPerTrack = 63;
+    pb->headCount = 255;
+    pb->totalSectors32 = total;
+    if (fatType == 16) {
+      pb->sectorsPerFat16 = fatBlocks;
+      pb->driveNumber = 0X80;
+      pb->bootSignature = EXTENDED_BOOT_SIG;
+      memcpy(pb->volumeLabel, "NO NAME    ", 11);
+      memcpy(pb->fileSystemType, "FAT16   ", 8);
+    } else {
+      fat32_boot_t* pb32 = reinterpret_cast<fat32_boot_t*>(&image[0]);
+      pb32->sectorsPerFat32 = fatBlocks;
+      pb32->fat32RootCluster = 2;
+      pb32->fat32FSInfo = 1;
+      pb32->fat32BackBootBlock = 6;
+      pb32->driveNumber = 0X80;
+      pb32->bootSignature = EXTENDED_BOOT_SIG;
+      memcpy(pb32->volumeLabel, "NO NAME    ", 11);
+      memcpy(pb32->fileSystemType, "FAT32   ", 8);
+      fat32_fsinfo_t* pf = reinterpret_cast<fat32_fsinfo_t*>(&image[512]);
+      pf->leadSignature = FSINFO_LEAD_SIG;
+      pf->structSignature = FSINFO_STRUCT_SIG;
+      pf->freeCount = 0XFFFFFFFF;
+      pf->nextFree = 0XFFFFFFFF;
+      image[1022] = BOOTSIG0;
+      image[1023] = BOOTSIG1;
+    }
+    image[510] = BOOTSIG0;
+    image[511] = BOOTSIG1;
+    for (uint8_t i = 0; i < 2; i++) {
+      uint8_t* fat = &image[(reserved + i*fatBlocks)*512];
+      if (fatType == 16) {
+        uint16_t e[2] = {0XFFF8, 0XFFFF};
+        memcpy(fat, e, sizeof(e));
+      } else {
+        // root directory is cluster 2
+        uint32_t e[3] = {0X0FFFFFF8, 0X0FFFFFFF, 0X0FFFFFFF};
+        memcpy(fat, e, sizeof(e));
+      }
+    }
+    return true;
+  }
+  /** Build a blank exFAT volume.  The allocation bitmap, a short
+   * up-case table and the root directory take one FAT chain each.
+   * \param[in] mb Size in MB.
+   * \param[in] clusterShift Log2 of the cluster size in blocks.
+   * \return true for success else false.
+   */
+  bool formatExFat(uint32_t mb, uint8_t clusterShift) {
+    uint32_t total = mb << 11;
+    uint32_t fatOffset = 24;
+    uint32_t fatLength = 1;
+    uint32_t heapOffset;
+    uint32_t clusters;
+    uint32_t clusterBytes = 512UL << clusterShift;
+    // grow the FAT until it maps every cluster left after it
+    while (1) {
+      heapOffset = fatOffset + fatLength;
+      clusters = (total - heapOffset) >> clusterShift;
+      uint32_t need = ((clusters + 2)*4 + 511)/512;
+      if (need <= fatLength) {
+        break;
+      }
+      fatLength = need;
+    }
+    if (clusters < 16) {
+      return false;
+    }
+    // up-case table for ASCII, other characters map to themselves
+    uint16_t upcase[128];
+    for (uint16_t c = 0; c < 128; c++) {
+      upcase[c] = 'a' <= c && c <= 'z' ? c - 'a' + 'A' : c;
+    }
+    uint32_t bitmapBytes = (clusters + 7)/8;
+    uint32_t bitmapClusters = (bitmapBytes + clusterBytes - 1)/clusterBytes;
+    uint32_t upcaseCluster = 2 + bitmapClusters;
+    uint32_t rootCluster = upcaseCluster + 1;
+
+    image.assign(total*512, 0);
+    exfat_boot_t* pb = reinterpret_cast<exfat_boot_t*>(&image[0]);
+    pb->jump[0] = 0XEB;
+    pb->jump[1] = 0X76;
+    pb->jump[2] = 0X90;
+    memcpy(pb->oemName, "EXFAT   ", 8);
+    pb->volumeLength = total;
+    pb->fatOffset = fatOffset;
+    pb->fatLength = fatLength;
+    pb->clusterHeapOffset = heapOffset;
+    pb->clusterCount = clusters;
+    pb->rootDirectoryCluster = rootCluster;
+    pb->volumeSerialNumber = 0X12345678;
+    pb->fileSystemRevision = 0X0100;
+    pb->bytesPerSectorShift = 9;
+    pb->sectorsPerClusterShift = clusterShift;
+    pb->numberOfFats = 1;
+    pb->driveSelect = 0X80;
+    pb->percentInUse = 0XFF;
+    pb->bootSignature[0] = BOOTSIG0;
+    pb->bootSignature[1] = BOOTSIG1;
+    // extended boot sectors
+    for (uint8_t i = 1; i < 9; i++) {
+      image[i*512 + 510] = BOOTSIG0;
+      image[i*512 + 511] = BOOTSIG1;
+    }
+    // boot region checksum, volumeFlags and percentInUse excluded
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < 11*512; i++) {
+      if (i != 106 && i != 107 && i != 112) {
+        sum = ((sum & 1) ? 0X80000000 : 0) + (sum >> 1) + image[i];
+      }
+    }
+    for (uint16_t i = 0; i < 512; i += 4) {
+      memcpy(&image[11*512 + i], &sum, 4);
+    }
+    // backup boot region
+    memcpy(&image[12*512], &image[0], 12*512);
+
+    // FAT chains, then mark the clusters used in the bitmap
+    uint32_t* fat = reinterpret_cast<uint32_t*>(&image[fatOffset*512]);
+    uint8_t* bitmap = &image[clusterOffset(heapOffset, clusterShift, 2)];
+    fat[0] = 0XFFFFFFF8;
+    fat[1] = 0XFFFFFFFF;
+    for (uint32_t c = 2; c <= rootCluster; c++) {
+      fat[c] = c + 1 < upcaseCluster ? c + 1 : 0XFFFFFFFF;
+      bitmap[(c - 2)/8] |= 1 << ((c - 2) % 8);
+    }
+    memcpy(&image[clusterOffset(heapOffset, clusterShift, upcaseCluster)],
+           upcase, sizeof(upcase));
+    uint32_t upcaseSum = 0;
+    const uint8_t* u = reinterpret_cast<const uint8_t*>(upcase);
+    for (size_t i = 0; i < sizeof(upcase); i++) {
+      upcaseSum = ((upcaseSum & 1) ? 0X80000000 : 0) + (upcaseSum >> 1) + u[i];
+    }
+    // root directory
+    size_t root = clusterOffset(heapOffset, clusterShift, rootCluster);
+    exfat_bitmap_t* pbm = reinterpret_cast<exfat_bitmap_t*>(&image[root]);
+    pbm->entryType = EXFAT_TYPE_BITMAP;
+    pbm->firstCluster = 2;
+    pbm->dataLength = bitmapBytes;
+    exfat_upcase_t* puc = reinterpret_cast<exfat_upcase_t*>(&image[root + 32]);
+    puc->entryType = EXFAT_TYPE_UPCASE;
+    puc->tableChecksum = upcaseSum;
+    puc->firstCluster = upcaseCluster;
+    puc->dataLength = sizeof(upcase);
+    return true;
+  }
+  /** Load an image file.
+   * \param[in] path File to read.
+   * \return true for success else false.
+   */
+  bool load(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+      return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    rewind(f);
+    image.resize(n);
+    bool rtn = fread(&image[0], 1, n, f) == (size_t)n;
+    fclose(f);
+    return rtn;
+  }
+  /** Save the image.
+   * \param[in] path File to write.
+   * \return true for success else false.
+   */
+  bool save(const char* path) {
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+      return false;
+    }
+    bool rtn = fwrite(&image[0], 1, image.size(), f) == image.size();
+    fclose(f);
+    return rtn;
+  }
+  /** Volume image, 512 byte blocks. */
+  std::vector<uint8_t> image;
+  /** Counts since the last clearStats(). */
+  RamStats stats;
+
+ private:
+  static size_t clusterOffset(uint32_t heapOffset, uint8_t clusterShift,
+                              uint32_t cluster) {
+    return (heapOffset + ((cluster - 2) << clusterShift))*512ULL;
+  }
+  bool inImage(uint32_t block, size_t count) {
+    return (block + count)*512ULL <= image.size();
+  }
+  bool readBlock(uint32_t block, uint8_t* dst) {
+    return readBlocks(block, dst, 1);
+  }
+  bool writeBlock(uint32_t block, const uint8_t* src) {
+    return writeBlocks(block, src, 1);
+  }
+  bool eraseBlocks(uint32_t firstBlock, uint32_t lastBlock) {
+    if (lastBlock < firstBlock || !inImage(firstBlock, lastBlock - firstBlock + 1)) {
+      return false;
+    }
+    memset(&image[firstBlock*512], 0XFF, (lastBlock - firstBlock + 1)*512);
+    return true;
+  }
+  bool syncBlocks() {
+    return true;
+  }
+  bool readBlocks(uint32_t block, uint8_t* dst, size_t nb) {
+    if (!inImage(block, nb)) {
+      return false;
+    }
+    memcpy(dst, &image[block*512], nb*512);
+    stats.reads += nb;
+    stats.readCmds++;
+    return true;
+  }
+  bool writeBlocks(uint32_t block, const uint8_t* src, size_t nb) {
+    if (!inImage(block, nb)) {
+      return false;
+    }
+    memcpy(&image[block*512], src, nb*512);
+    stats.writes += nb;
+    stats.writeCmds++;
+    return true;
+  }
+  bool readStart(uint32_t block) {
+    if (m_streamOpen) {
+      return false;
+    }
+    m_streamOpen = true;
+    m_streamBlock = block;
+    stats.readCmds++;
+    return true;
+  }
+  bool readData(uint8_t* dst) {
+    if (!m_streamOpen || !inImage(m_streamBlock, 1)) {
+      return false;
+    }
+    memcpy(dst, &image[m_streamBlock++*512], 512);
+    stats.reads++;
+    return true;
+  }
+  bool readStop() {
+    bool rtn = m_streamOpen;
+    m_streamOpen = false;
+    return rtn;
+  }
+  bool m_streamOpen;
+  uint32_t m_streamBlock;
+};
+#endif  // RamVolume_h
@@ -185,6 +185,8 @@ SerialRingBuffer::buf_size_t SerialRingBuffer::put_P(PGM_P b, buf_size_t n) {
 #if ENABLE_RX_ERROR_CHECKING
 //
 uint8_t rxErrorBits[SERIAL_PORT_COUNT];
+//
+uint16_t rxLostCount[SERIAL_PORT_COUNT];
 #endif  // ENABLE_RX_ERROR_CHECKING
 //------------------------------------------------------------------------------
 #if BUFFERED_RX
@@ -196,6 +198,9 @@ inline static void rx_isr(uint8_t n) {
   uint8_t e = *usart[n].ucsra & SP_UCSRA_ERROR_MASK;
   uint8_t b = *usart[n].udr;
   if (!rxRingBuf[n].put(b)) e |= SP_RX_BUF_OVERRUN;
+  if ((e & (SP_RX_BUF_OVERRUN | SP_RX_DATA_OVERRUN)) && rxLostCount[n] != 0xFFFF) {
+    rxLostCount[n]++;
+  }
   rxErrorBits[n] |= e;
 }
 #else  // ENABLE_RX_ERROR_CHECKING
@@ -275,6 +275,8 @@ extern SerialRingBuffer rxRingBuf[];
 extern SerialRingBuffer txRingBuf[];
 /** RX error bits. */
 extern uint8_t rxErrorBits[];
+/** RX bytes lost to overruns. */
+extern uint16_t rxLostCount[];
 //------------------------------------------------------------------------------
 /** Cause error message for bad port number.
  * @return Never returns since it is never called.
@@ -384,8 +386,14 @@ class SerialPort : public Stream {
   }
   //----------------------------------------------------------------------------
   #if ENABLE_RX_ERROR_CHECKING
-  /** Clear RX error bits. */
-  void clearRxError() {rxErrorBits[PortNumber] = 0;}
+  /** Clear RX error bits and the lost byte count. */
+  void clearRxError() {
+    uint8_t s = SREG;
+    cli();
+    rxErrorBits[PortNumber] = 0;
+    rxLostCount[PortNumber] = 0;
+    SREG = s;
+  }
   /** @return RX error bits. Possible error bits are:
    * - @ref SP_RX_BUF_OVERRUN
    * - @ref SP_RX_DATA_OVERRUN
@@ -394,6 +402,16 @@ class SerialPort : public Stream {
    * .
    */
   uint8_t getRxError() {return rxErrorBits[PortNumber];}
+  /** @return Number of received bytes dropped because the RX ring buffer
+   * was full or the USART overran.  The count saturates at 65535.
+   */
+  uint16_t getRxLostCount() {
+    uint8_t s = SREG;
+    cli();
+    uint16_t n = rxLostCount[PortNumber];
+    SREG = s;
+    return n;
+  }
   #endif  // ENABLE_RX_ERROR_CHECKING
   //----------------------------------------------------------------------------
   /**
@@ -0,0 +1,208 @@
+/*
+  OpenLog on-device card formatter - see CardFormat.h
+
+  Based on the SdFat SdFormatter example. The fixed 64KB/4MB alignment of the example is replaced
+  with the AU size the card reports.
+*/
+
+#include "CardFormat.h"
+#include "CardStatus.h"
+
+#if ENABLE_FORMAT_COMMAND
+
+//Blocks erased per erase command
+#define FORMAT_ERASE_BLOCKS 262144UL
+
+//The new volume
+struct formatLayout_t {
+  uint32_t au;              //Alignment in blocks
+  uint32_t cardBlocks;
+  uint32_t relSector;       //First block of the partition
+  uint32_t partSize;        //Blocks in the partition
+  uint32_t fatStart;
+  uint32_t fatSize;         //Blocks in one FAT
+  uint32_t dataStart;       //First block of cluster 2
+  uint16_t reservedSectors;
+  uint8_t sectorsPerCluster;
+  uint8_t partType;
+};
+
+//Pick the layout. Same rules as the SD Association formatter with the example's fixed
+//boundaries replaced by the AU. Returns false if the card is too small.
+static bool formatLayout(formatLayout_t* f, bool fat32)
+{
+  uint32_t capacityMB = (f->cardBlocks + 2047) / 2048;
+  uint32_t nc;
+
+  if (capacityMB <= 6) return (false);
+  if (capacityMB <= 16) f->sectorsPerCluster = 2;
+  else if (capacityMB <= 32) f->sectorsPerCluster = 4;
+  else if (capacityMB <= 64) f->sectorsPerCluster = 8;
+  else if (capacityMB <= 128) f->sectorsPerCluster = 16;
+  else if (capacityMB <= 1024) f->sectorsPerCluster = 32;
+  else if (capacityMB <= 32768) f->sectorsPerCluster = 64;
+  else f->sectorsPerCluster = 128; //SDXC
+
+  if (fat32)
+  {
+    //FATs sit between the partition boot sector and the first AU of data
+    f->relSector = f->au;
+    for (f->dataStart = 2 * f->au ; ; f->dataStart += f->au)
+    {
+      nc = (f->cardBlocks - f->dataStart) / f->sectorsPerCluster;
+      f->fatSize = (nc + 2 + 127) / 128;
+      if (f->dataStart >= f->relSector + 9 + 2 * f->fatSize) break;
+    }
+    if (nc < 65525) return (false);
+    f->reservedSectors = f->dataStart - f->relSector - 2 * f->fatSize;
+    f->partType = 0x0C; //FAT32 LBA
+  }
+  else
+  {
+    //The partition starts mid-AU so boot sector, FATs and the 32 block root directory end on a boundary
+    for (f->dataStart = 2 * f->au ; ; f->dataStart += f->au)
+    {
+      nc = (f->cardBlocks - f->dataStart) / f->sectorsPerCluster;
+      f->fatSize = (nc + 2 + 255) / 256;
+      uint32_t r = f->au + 1 + 2 * f->fatSize + 32;
+      if (f->dataStart < r) continue;
+      f->relSector = f->dataStart - r + f->au;
+      break;
+    }
+    if (nc < 4085 || nc >= 65525) return (false);
+    f->reservedSectors = 1;
+    f->partType = 0x0E; //FAT16 LBA
+  }
+  f->fatStart = f->relSector + f->reservedSectors;
+  f->partSize = nc * f->sectorsPerCluster + f->dataStart - f->relSector;
+  return (true);
+}
+
+static void clearCache(cache_t* cache, bool addSig)
+{
+  memset(cache, 0, sizeof(cache_t));
+  if (addSig)
+  {
+    cache->mbr.mbrSig0 = BOOTSIG0;
+    cache->mbr.mbrSig1 = BOOTSIG1;
+  }
+}
+
+//Zero count blocks with one multiple block write
+static bool clearBlocks(SdSpiCard* card, cache_t* cache, uint32_t block, uint32_t count, Print* pr)
+{
+  clearCache(cache, false);
+  if (!card->writeStart(block, count)) return (false);
+  for (uint32_t i = 0 ; i < count ; i++)
+  {
+    if ((i & 0x3FF) == 0) pr->print('.');
+    if (!card->writeData(cache->data)) return (false);
+  }
+  return (card->writeStop());
+}
+
+bool cardFormat(SdSpiCard* card, cache_t* cache, Print* pr)
+{
+  formatLayout_t f;
+  bool fat32 = card->type() == SD_CARD_TYPE_SDHC;
+
+  f.cardBlocks = card->cardSize();
+  cardStatus_t cs;
+  cardReadStatus(card, &cs);
+  f.au = cs.auBlocks;
+  if (f.au == 0) f.au = FORMAT_DEFAULT_AU_BLOCKS;
+  if (f.cardBlocks == 0 || !formatLayout(&f, fat32)) return (false);
+
+  //Erase everything so the card starts with all of its AUs free. Not all cards
+  //support erase, the format is still good without it.
+  for (uint32_t block = 0 ; block < f.cardBlocks ; block += FORMAT_ERASE_BLOCKS)
+  {
+    uint32_t last = block + FORMAT_ERASE_BLOCKS - 1;
+    if (last >= f.cardBlocks) last = f.cardBlocks - 1;
+    if (!card->erase(block, last)) break;
+    pr->print('.');
+  }
+
+  //MBR with a single partition. CHS fields are set to the 'use LBA' maximum.
+  clearCache(cache, true);
+  part_t* p = cache->mbr.part;
+  p->beginHead = p->endHead = 254;
+  p->beginSector = p->endSector = 63;
+  p->beginCylinderHigh = p->endCylinderHigh = 3;
+  p->beginCylinderLow = p->endCylinderLow = 255;
+  p->type = f.partType;
+  p->firstSector = f.relSector;
+  p->totalSectors = f.partSize;
+  if (!card->writeBlock(0, cache->data)) return (false);
+
+  //Partition boot sector. Both boot sector types share the fields up to totalSectors32.
+  clearCache(cache, true);
+  fat_boot_t* pb = &cache->fbs;
+  pb->jump[0] = 0xEB;
+  pb->jump[1] = 0x00;
+  pb->jump[2] = 0x90;
+  memset(pb->oemId, ' ', sizeof(pb->oemId));
+  pb->bytesPerSector = 512;
+  pb->sectorsPerCluster = f.sectorsPerCluster;
+  pb->reservedSectorCount = f.reservedSectors;
+  pb->fatCount = 2;
+  pb->mediaType = 0xF8;
+  pb->sectorsPerTrack = 63;
+  pb->headCount = 255;
+  pb->hidddenSectors = f.relSector;
+  pb->totalSectors32 = f.partSize;
+
+  uint32_t serialNumber = (f.cardBlocks << 8) + micros();
+  if (fat32)
+  {
+    fat32_boot_t* pb32 = &cache->fbs32;
+    pb32->sectorsPerFat32 = f.fatSize;
+    pb32->fat32RootCluster = 2;
+    pb32->fat32FSInfo = 1;
+    pb32->fat32BackBootBlock = 6;
+    pb32->driveNumber = 0x80;
+    pb32->bootSignature = EXTENDED_BOOT_SIG;
+    pb32->volumeSerialNumber = serialNumber;
+    memcpy_P(pb32->volumeLabel, PSTR("NO NAME    "), sizeof(pb32->volumeLabel));
+    memcpy_P(pb32->fileSystemType, PSTR("FAT32   "), sizeof(pb32->fileSystemType));
+    if (!card->writeBlock(f.relSector, cache->data) || !card->writeBlock(f.relSector + 6, cache->data)) return (false);
+
+    //Extra boot sector and FSINFO, each with its backup
+    clearCache(cache, true);
+    if (!card->writeBlock(f.relSector + 2, cache->data) || !card->writeBlock(f.relSector + 8, cache->data)) return (false);
+    cache->fsinfo.leadSignature = FSINFO_LEAD_SIG;
+    cache->fsinfo.structSignature = FSINFO_STRUCT_SIG;
+    cache->fsinfo.freeCount = 0xFFFFFFFF;
+    cache->fsinfo.nextFree = 0xFFFFFFFF;
+    if (!card->writeBlock(f.relSector + 1, cache->data) || !card->writeBlock(f.relSector + 7, cache->data)) return (false);
+
+    //Both FATs and the root directory cluster
+    if (!clearBlocks(card, cache, f.fatStart, 2 * f.fatSize + f.sectorsPerCluster, pr)) return (false);
+    clearCache(cache, false);
+    cache->fat32[0] = 0x0FFFFFF8;
+    cache->fat32[1] = 0x0FFFFFFF;
+    cache->fat32[2] = 0x0FFFFFFF;
+  }
+  else
+  {
+    pb->rootDirEntryCount = 512;
+    pb->sectorsPerFat16 = f.fatSize;
+    pb->driveNumber = 0x80;
+    pb->bootSignature = EXTENDED_BOOT_SIG;
+    pb->volumeSerialNumber = serialNumber;
+    memcpy_P(pb->volumeLabel, PSTR("NO NAME    "), sizeof(pb->volumeLabel));
+    memcpy_P(pb->fileSystemType, PSTR("FAT16   "), sizeof(pb->fileSystemType));
+    if (!card->writeBlock(f.relSector, cache->data)) return (false);
+
+    //Both FATs and the root directory
+    if (!clearBlocks(card, cache, f.fatStart, f.dataStart - f.fatStart, pr)) return (false);
+    clearCache(cache, false);
+    cache->fat16[0] = 0xFFF8;
+    cache->fat16[1] = 0xFFFF;
+  }
+
+  //Reserved FAT entries in both FATs
+  return (card->writeBlock(f.fatStart, cache->data) && card->writeBlock(f.fatStart + f.fatSize, cache->data));
+}
+
+#endif
@@ -0,0 +1,36 @@
+/*
+  OpenLog on-device card formatter
+
+  Lays out the card the way the SD Association formatter does so the card logs at its rated speed:
+
+    - The partition starts on an allocation unit (AU) boundary
+    - Reserved blocks pad the FATs so the cluster heap starts on an AU boundary
+    - Clusters are as large as the card class allows (32KB on SDHC, 64KB on SDXC) so every cluster
+      is written as whole flash pages and the FAT changes as little as possible
+
+  The AU size comes from the card's SD Status register (ACMD13). Cards that don't report one are
+  aligned to FORMAT_DEFAULT_AU_BLOCKS. The whole card is erased first so the card doesn't have to
+  copy old data around while logging.
+
+  Cards up to 2GB are formatted FAT16, SDHC and SDXC cards FAT32.
+*/
+
+#ifndef CardFormat_h
+#define CardFormat_h
+
+#include <SdFat.h>
+
+//Set to 1 to add the 'format' shell command. Costs roughly 2KB of flash, so on a stock ATmega328
+//build something else (DEBUG, INCLUDE_SIMPLE_EMBEDDED, ENABLE_TWI_INGEST) may have to go.
+#define ENABLE_FORMAT_COMMAND 0
+
+//Alignment used when the card doesn't report an AU size, 4MB is the largest AU of SDHC cards
+#define FORMAT_DEFAULT_AU_BLOCKS 8192UL
+
+#if ENABLE_FORMAT_COMMAND
+//Erases and formats the whole card. cache is used as a scratch block.
+//Progress dots are printed to pr. Returns false if the card couldn't be written.
+bool cardFormat(SdSpiCard* card, cache_t* cache, Print* pr);
+#endif
+
+#endif
@@ -0,0 +1,48 @@
+/*
+  OpenLog card performance metadata - see CardStatus.h
+
+  Field positions are from the SD Physical Layer Simplified Specification, SD Status register.
+  The register is 512 bits, sent most significant byte first.
+*/
+
+#include "CardStatus.h"
+
+//SPEED_CLASS codes 0 to 4
+static const uint8_t speedClassCode[] PROGMEM = {0, 2, 4, 6, 10};
+
+//SDXC AU_SIZE codes 0xA to 0xF, in MB
+static const uint8_t sdxcAuMB[] PROGMEM = {8, 12, 16, 24, 32, 64};
+
+bool cardReadStatus(SdSpiCard* card, cardStatus_t* cs)
+{
+  uint8_t status[64];
+
+  memset(cs, 0, sizeof(cardStatus_t));
+  if (!card->readStatus(status)) return (false);
+
+  //SPEED_CLASS, bits 447:440
+  if (status[8] < sizeof(speedClassCode)) cs->speedClass = pgm_read_byte(&speedClassCode[status[8]]);
+
+  //AU_SIZE, bits 431:428. 16KB doubling up to 4MB, then the SDXC sizes.
+  uint8_t code = status[10] >> 4;
+  if (code == 0) cs->auBlocks = 0; //Not defined
+  else if (code < 0xA) cs->auBlocks = 32UL << (code - 1);
+  else cs->auBlocks = (uint32_t)pgm_read_byte(&sdxcAuMB[code - 0xA]) << 11;
+
+  //ERASE_SIZE, bits 423:408. ERASE_TIMEOUT, bits 407:402.
+  cs->eraseSize = ((uint16_t)status[11] << 8) | status[12];
+  cs->eraseTimeout = status[13] >> 2;
+
+  //UHS_SPEED_GRADE, bits 399:396. VIDEO_SPEED_CLASS, bits 391:384.
+  cs->uhsGrade = status[14] >> 4;
+  cs->videoClass = status[15];
+  return (true);
+}
+
+uint8_t cardRatedMBps(const cardStatus_t* cs)
+{
+  uint8_t rate = cs->speedClass;
+  if (cs->uhsGrade * 10 > rate) rate = cs->uhsGrade * 10; //U1 10MB/s, U3 30MB/s
+  if (cs->videoClass > rate) rate = cs->videoClass; //V6 to V90 are MB/s
+  return (rate);
+}
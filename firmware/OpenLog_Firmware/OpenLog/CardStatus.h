@@ -0,0 +1,38 @@
+/*
+  OpenLog card performance metadata
+
+  Reads the card's SD Status register (ACMD13) and keeps the fields that say how the card wants
+  to be written:
+
+    - Speed class, UHS speed grade and video speed class: the sequential write rate the card
+      guarantees, as long as it is written an allocation unit (AU) at a time
+    - AU size: the unit the card erases and fills internally
+    - Erase size and timeout: how long erasing a number of AUs may take
+
+  Cards older than SD 2.0 (SD1) don't have the register, or leave the fields at zero. Everything
+  then reads as not reported and the compile time defaults in OpenLog.ino are used.
+*/
+
+#ifndef CardStatus_h
+#define CardStatus_h
+
+#include <SdFat.h>
+
+struct cardStatus_t {
+  uint32_t auBlocks;     //Allocation unit in 512 byte blocks, 0 if not reported
+  uint16_t eraseSize;    //AUs that can be erased within eraseTimeout, 0 if not reported
+  uint8_t eraseTimeout;  //Seconds
+  uint8_t speedClass;    //Class 2, 4, 6 or 10, 0 if the card isn't rated
+  uint8_t uhsGrade;      //UHS speed grade 1 or 3, 0 if none
+  uint8_t videoClass;    //Video speed class 6 to 90, 0 if none
+};
+
+//Reads the SD Status register. Fields the card doesn't report are 0.
+//Returns false and zeroes everything if the card doesn't answer ACMD13.
+bool cardReadStatus(SdSpiCard* card, cardStatus_t* cs);
+
+//The write rate in MB/s the card guarantees, the best of its speed class, UHS grade and video class.
+//0 if the card isn't rated.
+uint8_t cardRatedMBps(const cardStatus_t* cs);
+
+#endif
@@ -69,8 +69,12 @@
 #include <SerialPort.h> //This is a new/beta library written by Bill Greiman. You rock Bill! https://github.com/greiman/SerialPort
 #include <EEPROM.h>
 #include <FreeStack.h> //Allows us to print the available stack/RAM size
+#include "TwiIngest.h" //Optional I2C slave input. Enable it in TwiIngest.h
+#include "CardFormat.h" //Optional on-device format command. Enable it in CardFormat.h
+#include "CardStatus.h" //Speed class and AU size of the card
 
-SerialPort<0, 512, 0> NewSerial;
+#define RX_BUFF_SIZE 512
+SerialPort<0, RX_BUFF_SIZE, 0> NewSerial;
 //<port #, RX buffer size, TX buffer size>
 //We set the TX buffer to zero because we will be spending most of our
 //time needing to buffer the incoming (RX) characters.
@@ -102,6 +106,65 @@ void(* Reset_AVR) (void) = 0; //Way of resetting the ATmega
 #define CFG_LENGTH (strlen(MAX_CFG) + 1) //Length of text found in config file. strlen ignores \0 so we have to add it back 
 #define SEQ_FILENAME "SEQLOG00.TXT\0" //This is the name for the file when you're in sequential mode
 
+//The stock OpenLog is an ATmega328 with 32KB of flash. The optional features below don't fit there along with the
+//logger and the shell, so they default to on only for larger parts, found with the same RAMEND test SdFatConfig.h
+//uses. On a 328 one can be turned on by hand once something else is taken out to make room.
+#if defined(RAMEND) && RAMEND < 3000
+#define LARGE_TARGET 0
+#else
+#define LARGE_TARGET 1
+#endif
+
+//Boot capture: once the card is mounted and config.txt read, serial data is moved from the RX buffer to a temporary
+//file while the next log number is found. When logging starts the temporary file becomes
+//(or is copied into) the log. Without this, a busy card at 115200bps can overflow the RX buffer at power up.
+#define ENABLE_BOOT_CAPTURE LARGE_TARGET
+#define BOOT_CAPTURE_FILENAME "BOOTCAP.TMP\0"
+#define BOOT_CAPTURE_THRESHOLD 64 //Only touch the card once this many bytes are waiting in the RX buffer
+
+//Log files grow by this many bytes at a time, reserved contiguously in one FAT update instead of one cluster per update.
+//The unused part is freed whenever OpenLog goes idle so a power loss while asleep doesn't leave lost clusters.
+//Has no effect on cards whose clusters are this size or larger. Set to 0 to allocate one cluster at a time.
+//Cards that report an AU between this and LOG_EXTENT_MAX get one AU at a time instead. See logExtentSize().
+#define LOG_EXTENT_SIZE 32768UL
+//Largest extent. An extent is one contiguous allocation search and, after a power loss, that many bytes of lost
+//clusters, so it stays near LOG_EXTENT_SIZE rather than following the AU up to 4MB.
+#define LOG_EXTENT_MAX (2 * LOG_EXTENT_SIZE)
+
+//While data keeps arriving, a card with a speed class is synced once per AU written so a power loss costs at most
+//one AU of log. A sync writes up to this many blocks (directory entry, FAT, FAT mirror and FSINFO) outside the AU
+//being filled, and the card can stay busy after each one as long as the longest stall measured so far. A due sync
+//waits until the free part of the RX buffer lasts that long at the configured baud rate. See syncFits().
+//Unrated cards, and builds without ENABLE_SD_LATENCY_STATS, are synced when OpenLog goes idle.
+#define SYNC_WRITES 4
+
+//Each time OpenLog goes idle, up to this many bytes of the free clusters the log grows into next are erased. The
+//card then doesn't have to erase while the log is written, which lowers the worst case write time. Clusters are
+//erased one at a time and erasing stops when a character arrives, see preEraseLog(). Set to 0 to disable.
+#if LARGE_TARGET
+#define PRE_ERASE_SIZE 65536UL
+#else
+#define PRE_ERASE_SIZE 0
+#endif
+
+//Shell file handles: 'open <file>' returns a handle (#0, #1, ..) that read, write and size accept in place of a file name.
+//The file stays open between commands, so reading or writing a file in chunks continues where the last chunk ended
+//without a directory search or a walk of the cluster chain. Each handle takes about 40 bytes of stack while the shell
+//runs. Set to 0 to remove the open, seek and close commands.
+#if LARGE_TARGET
+#define FILE_HANDLE_COUNT 2
+#else
+#define FILE_HANDLE_COUNT 0
+#endif
+
+//Boot timing: millis() at the end of each power up stage is kept and shown by the 'boot' command.
+//Costs 10 bytes of RAM. Set to 0 to remove.
+#define ENABLE_BOOT_TIMING LARGE_TARGET
+
+//SPI clock tuning: the fastest SPI clock each card reads cleanly at is found once and kept in EEPROM, see beginCard().
+//When 0 every card is mounted at full speed.
+#define ENABLE_SCK_TUNING LARGE_TARGET
+
 //Internal EEPROM locations for the user settings
 #define LOCATION_SYSTEM_SETTING		  0x02
 #define LOCATION_FILE_NUMBER_LSB	  0x03
@@ -116,6 +179,11 @@ void(* Reset_AVR) (void) = 0; //Way of resetting the ATmega
 #define LOCATION_IGNORE_RX		      0x0C
 #define LOCATION_MAX_FILESIZE_MB    0x0D    // In MODE_ROTATE, this is the maximum size (in MB) that a file is allowed to grow to before starting a new file
 #define LOCATION_MAX_FILENUMBER     0x0E    // In MODE_ROTATE, this is the highest allowed value of newFileNumer in NeLog() before wrapping around to zero
+#define LOCATION_SCK_DIVISOR        0x0F    // Fastest SPI clock divisor found for the card below, see beginCard()
+#define LOCATION_CARD_SERIAL        0x10    // 4 bytes, serial number from the CID of the card the divisor was found for
+#define LOCATION_CARD_TYPE          0x14    // SD1, SD2 or SDHC. Checked along with the serial number to recognize the card.
+#define LOCATION_CARD_ID            0x15    // 8 bytes, manufacturer, OEM and product name from the CID, also checked
+#define CARD_ID_SIZE                8
 
 #define BAUD_MIN  300
 #define BAUD_MAX  1000000
@@ -180,6 +248,36 @@ static struct commandArg cmd_arg[MAX_COUNT_COMMAND_LINE_ARGS];
 
 byte feedbackMode = (ECHO | EXTENDED_INFO);
 
+#if ENABLE_BOOT_CAPTURE
+SdFile bootFile; //Holds serial data received before the log file is ready
+unsigned long bootBytesCaptured = 0; //Bytes saved to bootFile before logging started
+unsigned int bootBytesLost = 0; //Bytes dropped by a full RX buffer before logging started
+#endif
+
+//Power up stages, in order
+#define BOOT_CARD     0 //Card out of its idle state
+#define BOOT_MOUNT    1 //Card speed known and volume mounted
+#define BOOT_CONFIG   2 //config.txt read
+#define BOOT_LOG      3 //Log file found and opened
+#define BOOT_READY    4 //'<' or '>' sent
+#define BOOT_STAGES   5
+
+#if ENABLE_BOOT_TIMING
+unsigned int bootTime[BOOT_STAGES]; //millis() at the end of each stage, 0 until it is reached
+#endif
+
+bool cardKnown = false; //The card is the one this unit mounted last time, see beginCard()
+cardStatus_t cardStatus; //Read from the card at mount, all zero if it doesn't report one
+
+#if ENABLE_TWI_INGEST
+//Sink for the I2C ingest channel. Bytes go into the same ring buffer that the UART RX interrupt fills
+//so the rest of the firmware cannot tell them apart from serial characters.
+bool twiToSerialBuffer(uint8_t b)
+{
+  return (rxRingBuf[0].put(b));
+}
+#endif
+
 //Handle errors by printing the error type and blinking LEDs in certain way
 //The function will never exit - it loops forever inside blinkError
 void systemError(byte errorType)
@@ -188,7 +286,9 @@ void systemError(byte errorType)
   switch (errorType)
   {
     case ERROR_CARD_INIT:
-      NewSerial.print(F("card.init"));
+      //Out of the box SDXC cards are exFAT, mounted only if ENABLE_EXFAT is set
+      if (sd.vol()->isExFat()) NewSerial.print(F("card.init exFAT, format card FAT32"));
+      else NewSerial.print(F("card.init"));
       blinkError(ERROR_SD_INIT);
       break;
     case ERROR_VOLUME_INIT:
@@ -220,7 +320,12 @@ void setup(void)
   DIDR0 = 0x3F; //Disable digital input buffers on all ADC0-ADC5 pins
   DIDR1 = (1 << AIN1D) | (1 << AIN0D); //Disable digital input buffer on AIN1/0
 
+#if ENABLE_TWI_INGEST
+  //TWI stays powered; bytes received over I2C are fed into the serial RX buffer
+  twiIngestBegin(TWI_INGEST_ADDRESS, twiToSerialBuffer);
+#else
   power_twi_disable();
+#endif
   power_timer1_disable();
   power_timer2_disable();
   power_adc_disable();
@@ -247,13 +352,20 @@ void setup(void)
 #endif
 
   //Setup SD & FAT
-  if (!sd.begin(SD_CHIP_SELECT, SPI_FULL_SPEED)) systemError(ERROR_CARD_INIT);
+  if (!beginCard()) systemError(ERROR_CARD_INIT);
   if (!sd.chdir()) systemError(ERROR_ROOT_INIT); //Change to root directory. All new file creation will be in root.
 
   NewSerial.print(F("2"));
 
   //Search for a config file and load any settings found. This will over-ride previous EEPROM settings if found.
   readConfigFile();
+  bootStage(BOOT_CONFIG);
+
+#if ENABLE_BOOT_CAPTURE
+  //Started after the config file so the mode is final. Until here data waits in the RX buffer.
+  bootCaptureStart();
+  bootCapture(false);
+#endif
 
   if (setting_ignore_RX == OFF) //If we are NOT ignoring RX, then
     checkEmergencyReset(); //Look to see if the RX pin is being pulled low
@@ -286,6 +398,66 @@ void loop(void)
   commandShell();
 }
 
+//Returns the number of a LOG#####.TXT directory entry, 0xFFFF if the name is anything else
+unsigned int logFileNumber(const uint8_t* name)
+{
+  if (memcmp_P(name, PSTR("LOG"), 3) || memcmp_P(name + 8, PSTR("TXT"), 3)) return (0xFFFF);
+
+  unsigned long number = 0;
+  for (byte i = 3 ; i < 8 ; i++)
+  {
+    if (!isdigit(name[i])) return (0xFFFF);
+    number = number * 10 + (name[i] - '0');
+  }
+  if (number > 65533) return (0xFFFF);
+  return (number);
+}
+
+//Lowest log number that has no file on the card, 0xFFFF if all of them are taken
+//Only needed once the log numbers run out. Two passes over the directory however full the card is: the first
+//counts the logs in each run of 255 numbers, the second marks the numbers of the first run that isn't full.
+//Names in a directory are unique, so a count of 255 means the run is full.
+unsigned int lowestFreeLogNumber(void)
+{
+  byte count[(65534 + 254) / 255]; //Logs in each run, the last run is 65280 to 65533
+  dir_t dir;
+  unsigned int number;
+  unsigned int run; //257 runs, too many for a byte
+
+  memset(count, 0, sizeof(count));
+  sd.vwd()->rewind();
+  while (sd.vwd()->readDir(&dir) > 0)
+  {
+    number = logFileNumber(dir.name);
+    if (number != 0xFFFF) count[number / 255]++;
+
+#if ENABLE_BOOT_CAPTURE
+    bootCapture(false); //Each pass reads the whole directory
+#endif
+  }
+
+  for (run = 0 ; count[run] >= (run == sizeof(count) - 1 ? 254 : 255) ; run++)
+    if (run == sizeof(count) - 1) return (0xFFFF);
+
+  //The first 32 bytes hold the bitmap of the run
+  unsigned int base = run * 255U;
+  memset(count, 0, 32);
+  sd.vwd()->rewind();
+  while (sd.vwd()->readDir(&dir) > 0)
+  {
+    number = logFileNumber(dir.name);
+    if (number == 0xFFFF || number < base || number - base > 254) continue;
+    count[(number - base) >> 3] |= 1 << ((number - base) & 7);
+
+#if ENABLE_BOOT_CAPTURE
+    bootCapture(false);
+#endif
+  }
+
+  for (byte i = 0 ; ; i++)
+    if ((count[i >> 3] & (1 << (i & 7))) == 0) return (base + i);
+}
+
 //Log to a new file everytime the system boots
 //Checks the spots in EEPROM for the next available LOG# file name
 //Updates EEPROM and then appends to the new log file.
@@ -315,15 +487,9 @@ char* newLog(void)
     EEPROM.write(LOCATION_FILE_NUMBER_MSB, 0x00);
   }
 
-  //The above code looks like it will forever loop if we ever create 65535 logs
-  //Let's quit if we ever get to 65534
   //65534 logs is quite possible if you have a system with lots of power on/off cycles
-  if (newFileNumber == 65534)
-  {
-    //Gracefully drop out to command prompt with some error
-    NewSerial.print(F("!Too many logs:1!"));
-    return (0); //Bail!
-  }
+  //Once the numbers run out start over at 0, the search below then reuses the lowest free number
+  if (newFileNumber >= 65534) newFileNumber = 0;
 
   // For MODE_ROTATE, we want to loop back around to filenmber 0 if we've gone beyond what our maximum is
   if ((setting_systemMode == MODE_ROTATE) && (newFileNumber > setting_max_filenumber))
@@ -353,37 +519,56 @@ char* newLog(void)
   }
   else
   {
-    // For all other modes, search for next available log spot
-    while (1)
+    //Find the next log number with one pass over the directory. Opening each candidate in turn costs a full
+    //directory scan per try, which takes minutes when EEPROM is far behind the card (card moved between units,
+    //EEPROM reset). The new log is numbered past every log on the card so it sorts last.
+    unsigned int nextFileNumber = newFileNumber; //One past the highest log on the card
+    unsigned int emptyFileNumber = 0xFFFF; //Lowest empty log at or past the EEPROM number
+    dir_t dir;
+    int8_t result;
+
+    sd.vwd()->rewind();
+    while ((result = sd.vwd()->readDir(&dir)) > 0)
     {
-      sprintf_P(newFileName, PSTR("LOG%05u.TXT"), newFileNumber); //Splice the new file number into this file name
+      unsigned int number = logFileNumber(dir.name);
+      if (number == 0xFFFF || !DIR_IS_FILE(&dir)) continue;
 
-      // O_CREAT - create the file if it does not exist
-      // O_APPEND - seek to the end of the file prior to each write
-      // O_WRITE - open for write
-      // O_EXCL - if O_CREAT and O_EXCEL are set, open() shall fail if file exists
+      if (number >= nextFileNumber) nextFileNumber = number + 1;
 
-      //Try to open file, if it opens (file doesn't exist), then break
-      if (newFile.open(newFileName, O_CREAT | O_EXCL | O_WRITE)) break;
+      //Empty files get reused, same as before
+      if (dir.fileSize == 0 && number >= newFileNumber && number < emptyFileNumber) emptyFileNumber = number;
 
-      //Try to open file and see if it is empty. If so, use it.
-      if (newFile.open(newFileName, O_READ))
-      {
-        if (newFile.fileSize() == 0)
-        {
-          newFile.close();        // Close this existing file we just opened.
-          return (newFileName); // Use existing empty file.
-        }
-        newFile.close(); // Close this existing file we just opened.
-      }
+#if ENABLE_BOOT_CAPTURE
+      bootCapture(false); //Searching can take a while on a full card
+#endif
+    }
 
-      //Try the next number
-      newFileNumber++;
-      if (newFileNumber > 65533) //There is a max of 65534 logs
-      {
-        NewSerial.print(F("!Too many logs:2!"));
-        return (0); //Bail!
-      }
+    if (emptyFileNumber != 0xFFFF)
+    {
+      sprintf_P(newFileName, PSTR("LOG%05u.TXT"), emptyFileNumber);
+      return (newFileName); // Use existing empty file.
+    }
+
+    newFileNumber = nextFileNumber;
+    if (newFileNumber > 65533) newFileNumber = lowestFreeLogNumber(); //LOG65533.TXT exists, fill a gap instead
+    sprintf_P(newFileName, PSTR("LOG%05u.TXT"), newFileNumber); //Splice the new file number into this file name
+
+    if (newFileNumber > 65533) //There is a max of 65534 logs
+    {
+      NewSerial.print(F("!Too many logs:2!"));
+      return (0); //Bail!
+    }
+
+    //The pass above read to the end of the directory and found no log with this number, so the file is created
+    //at the end without searching the directory again. After a read error the name isn't known to be free and
+    //O_EXCL searches for it.
+    unsigned int endIndex = sd.vwd()->curPosition() / 32;
+    if (endIndex > 0) endIndex--; //readDir() stops past the end marker
+    if (result == 0 ? !newFile.createAt(sd.vwd(), newFileName, endIndex, O_WRITE)
+        : !newFile.open(newFileName, O_CREAT | O_EXCL | O_WRITE))
+    {
+      NewSerial.print(F("!Too many logs:2!"));
+      return (0); //Bail!
     }
     newFile.close(); //Close this new file we just opened
   }
@@ -435,6 +620,82 @@ void seqLog(void)
   appendFile(sequentialFileName);
 }
 
+#if ENABLE_BOOT_CAPTURE
+//Open the capture file once the card is mounted and the config file read
+//Only done if we are going to log at power up. In command mode the RX data is meant for the shell.
+void bootCaptureStart(void)
+{
+  if (setting_systemMode == MODE_COMMAND) return;
+
+  char captureFileName[strlen(BOOT_CAPTURE_FILENAME) + 1];
+  strcpy_P(captureFileName, PSTR(BOOT_CAPTURE_FILENAME));
+
+  //O_APPEND lets us keep adding to the end while bootCaptureFinish() reads from the front
+  bootFile.open(captureFileName, O_CREAT | O_TRUNC | O_RDWR | O_APPEND);
+}
+
+//Move what is waiting in the RX buffer to the capture file
+//Called between the slow steps of power up. Unless drainAll is set we wait until a few bytes have
+//piled up so we don't bounce the SD cache between the capture file and directory searches.
+void bootCapture(bool drainAll)
+{
+  if (!bootFile.isOpen()) return;
+  if (!drainAll && NewSerial.available() < BOOT_CAPTURE_THRESHOLD) return;
+
+  byte buffer[32];
+  byte n;
+  while ((n = NewSerial.read(buffer, sizeof(buffer))) > 0)
+  {
+#if ENABLE_TWI_INGEST
+    twiIngestPoll(); //There is room again, let an I2C master that was held off continue
+#endif
+    bootFile.write(buffer, n);
+    bootBytesCaptured += n;
+  }
+}
+
+//Logging is about to start on logFile. Hand it everything captured during power up.
+//If the log is empty the capture file is simply renamed to take its place. Otherwise (MODE_SEQLOG)
+//the capture file is copied onto the end of the log.
+void bootCaptureFinish(SdFile* logFile, char* fileName)
+{
+  if (!bootFile.isOpen()) return;
+
+  bootCapture(true);
+  bootBytesLost = NewSerial.getRxLostCount();
+  NewSerial.clearRxError(); //Later losses aren't boot losses
+
+  if (logFile->fileSize() == 0)
+  {
+    logFile->remove();
+    if (bootFile.rename(sd.vwd(), fileName))
+    {
+      bootFile.close();
+      if (!logFile->open(fileName, O_APPEND | O_WRITE)) systemError(ERROR_FILE_OPEN);
+      return;
+    }
+    //Rename failed, fall back to copying into a fresh log
+    if (!logFile->open(fileName, O_CREAT | O_APPEND | O_WRITE)) systemError(ERROR_FILE_OPEN);
+  }
+
+  //Keep moving new RX data to the end of the capture file while we copy from the front of it.
+  //The card is much faster than the UART so the copy catches up.
+  byte buffer[32];
+  unsigned long position = 0;
+  while (position < bootFile.fileSize())
+  {
+    bootFile.seekSet(position);
+    int n = bootFile.read(buffer, sizeof(buffer));
+    if (n <= 0) break;
+    logFile->write(buffer, n);
+    position += n;
+
+    bootCapture(false);
+  }
+  bootFile.remove();
+}
+#endif
+
 //This is the most important function of the device. These loops have been tweaked as much as possible.
 //Modifying this loop may negatively affect how well the device can record at high baud rates.
 //Appends a stream of serial data to a given file
@@ -470,12 +731,28 @@ byte appendFile(char* fileName)
     if (!workingFile.open(fileName, O_CREAT | O_TRUNC | O_WRITE)) systemError(ERROR_FILE_OPEN);
   }
 
+  bootStage(BOOT_LOG);
+
+#if ENABLE_BOOT_CAPTURE
+  bootCaptureFinish(&workingFile, fileName); //Put anything received during power up at the start of this log
+  totalBytesWritten = workingFile.fileSize(); //Captured data counts towards MODE_ROTATE's file size
+#endif
+
+  workingFile.setExtentSize(logExtentSize()); //After boot capture, which may reopen the file
+
   if (workingFile.fileSize() == 0) {
     //This is a trick to make sure first cluster is allocated - found in Bill's example/beta code
     workingFile.rewind();
     workingFile.sync();
   }
 
+#if PRE_ERASE_SIZE
+  //Log size at the last pre-erase. The first pre-erase waits for the first idle, as data may already be arriving and
+  //an erase here would stall it. Starting half an erase behind makes the idle check below true the first time.
+  //Unsigned math wraps, so this works for short logs too.
+  unsigned long preErasedSize = workingFile.fileSize() - PRE_ERASE_SIZE / 2;
+#endif
+
   //This is the 2nd buffer. It pulls from the larger Serial buffer as quickly as possible.
   //The built-in Arduino serial buffer is 64 bytes: https://www.arduino.cc/en/Serial/Available
   byte localBuffer[LOCAL_BUFF_SIZE];
@@ -485,6 +762,8 @@ byte appendFile(char* fileName)
 
   const unsigned int MAX_IDLE_TIME_MSEC = 500; //The number of milliseconds before unit goes to sleep
   unsigned long lastSyncTime = millis(); //Keeps track of the last time the file was synced
+  const uint32_t syncSize = logSyncSize(); //Sync after this many bytes even if data doesn't stop, 0 for never
+  uint32_t unsyncedBytes = 0;
 
 #if DEBUG
   NewSerial.print(F("FreeStack: "));
@@ -492,6 +771,7 @@ byte appendFile(char* fileName)
 #endif
 
   NewSerial.print(F("<")); //give a different prompt to indicate no echoing
+  bootStage(BOOT_READY);
   digitalWrite(stat1, HIGH); //Turn on indicator LED
 
   //Check if we should ignore escape characters
@@ -504,12 +784,22 @@ byte appendFile(char* fileName)
     while (1)
     {
       byte charsToRecord = NewSerial.read(localBuffer, sizeof(localBuffer)); //Read characters from global buffer into the local buffer
+#if ENABLE_TWI_INGEST
+      twiIngestPoll(); //We just made room in the buffer, release the I2C bus if it was stretched
+#endif
       if (charsToRecord > 0)
       {
         workingFile.write(localBuffer, charsToRecord); //Record the buffer to the card
 
         toggleLED(stat1); //Toggle the STAT1 LED each time we record the buffer
 
+        unsyncedBytes += charsToRecord;
+        if (syncSize && unsyncedBytes >= syncSize && syncFits())
+        {
+          workingFile.sync(); //Another AU logged, commit it to the FAT and directory
+          unsyncedBytes = 0;
+        }
+
         // For MODE_ROTATE, we need to keep track of how many bytes we have written to the file.
         // When it gets more than setting_max_filesize_MB, we exit (so as to close this file and start another)
         if (setting_systemMode == MODE_ROTATE)
@@ -530,7 +820,14 @@ byte appendFile(char* fileName)
       //No characters received?
       else if ( (millis() - lastSyncTime) > MAX_IDLE_TIME_MSEC) //If we haven't received any characters in 2s, goto sleep
       {
+        workingFile.truncate(workingFile.fileSize()); //Free the clusters reserved past the end of the log
         workingFile.sync(); //Sync the card before we go to sleep
+        unsyncedBytes = 0;
+#if PRE_ERASE_SIZE
+        //Get the clusters the log grows into next ready while nothing is arriving, once half of them have been used
+        if (workingFile.fileSize() - preErasedSize >= PRE_ERASE_SIZE / 2 && preEraseLog(&workingFile))
+          preErasedSize = workingFile.fileSize();
+#endif
 
         digitalWrite(stat1, LOW); //Turn off stat LED to save power
 
@@ -562,6 +859,9 @@ byte appendFile(char* fileName)
   while (escapeCharsReceived < setting_max_escape_character)
   {
     byte charsToRecord = NewSerial.read(localBuffer, sizeof(localBuffer)); //Read characters from global buffer into the local buffer
+#if ENABLE_TWI_INGEST
+    twiIngestPoll(); //We just made room in the buffer, release the I2C bus if it was stretched
+#endif
     if (charsToRecord > 0) //If we have characters, check for escape characters
     {
       if (localBuffer[0] == setting_escape_character)
@@ -588,6 +888,13 @@ byte appendFile(char* fileName)
 
       toggleLED(stat1); //Toggle the STAT1 LED each time we record the buffer
 
+      unsyncedBytes += charsToRecord;
+      if (syncSize && unsyncedBytes >= syncSize && syncFits())
+      {
+        workingFile.sync(); //Another AU logged, commit it to the FAT and directory
+        unsyncedBytes = 0;
+      }
+
       // For MODE_ROTATE, we need to keep track of how many bytes we have written to the file.
       // When it gets more than setting_max_filesize_MB, we exit (so as to close this file and start another)
       if (setting_systemMode == MODE_ROTATE)
@@ -608,7 +915,14 @@ byte appendFile(char* fileName)
     //No characters recevied?
     else if ( (millis() - lastSyncTime) > MAX_IDLE_TIME_MSEC) //If we haven't received any characters in 2s, goto sleep
     {
+      workingFile.truncate(workingFile.fileSize()); //Free the clusters reserved past the end of the log
       workingFile.sync(); //Sync the card before we go to sleep
+      unsyncedBytes = 0;
+#if PRE_ERASE_SIZE
+      //Get the clusters the log grows into next ready while nothing is arriving, once half of them have been used
+      if (workingFile.fileSize() - preErasedSize >= PRE_ERASE_SIZE / 2 && preEraseLog(&workingFile))
+        preErasedSize = workingFile.fileSize();
+#endif
 
       digitalWrite(stat1, LOW); //Turn off stat LED to save power
 
@@ -665,6 +979,174 @@ void blinkError(byte ERROR_TYPE) {
   }
 }
 
+//Mounts the card at the fastest SPI clock it reads reliably at
+//Some cards, or cards on long traces, fail at full speed. The first time a card is seen its speed is tuned
+//by reading block 0 at full speed and then slower until it reads back cleanly. The result is stored in
+//EEPROM with the card's manufacturer, OEM, product name, serial number and type so the next boot recognizes
+//the card and goes straight to that speed. Serial numbers are only unique for one manufacturer and product.
+//The SD power up sequence (CMD0, CMD8, ACMD41) and the MBR read are still needed for a known card. The card
+//only leaves its idle state through them, and the MBR is the only safe way to find the volume.
+//Without ENABLE_SCK_TUNING every card is mounted at full speed.
+bool beginCard(void)
+{
+  SdSpiCard* card = sd.card();
+
+  cardKnown = false;
+  if (!sd.cardBegin(SD_CHIP_SELECT, SPI_FULL_SPEED)) return (false);
+  bootStage(BOOT_CARD);
+
+#if ENABLE_SCK_TUNING
+  cid_t cid;
+
+  //The speed isn't known yet, read the CID slowly
+  card->setSckDivisor(SPI_SCK_INIT_DIVISOR);
+  if (!card->readCID(&cid)) return (false);
+  cardReadStatus(card, &cardStatus); //SD1 cards don't have one, logging then uses the defaults
+
+  byte divisor = EEPROM.read(LOCATION_SCK_DIVISOR);
+  if (eepromReadLong(LOCATION_CARD_SERIAL) == cid.psn && EEPROM.read(LOCATION_CARD_TYPE) == card->type()
+      && eepromMatch(LOCATION_CARD_ID, (byte*)&cid, CARD_ID_SIZE) && divisor >= SPI_FULL_SPEED && divisor <= SPI_SCK_INIT_DIVISOR)
+  {
+    card->setSckDivisor(divisor);
+    if (sd.fsBegin())
+    {
+      cardKnown = true;
+      bootStage(BOOT_MOUNT);
+      return (true);
+    }
+    //The stored speed no longer works, tune again
+  }
+
+  //Tuning fails on a card without a boot signature in block 0. It is then mounted at the slow speed and nothing is stored.
+  cache_t* cache = sd.vol()->cacheClear();
+  card->setSckDivisor(SPI_FULL_SPEED);
+  if (cache == 0 || !card->tuneSckDivisor(cache->data))
+  {
+    card->setSckDivisor(SPI_SCK_INIT_DIVISOR);
+    if (!sd.fsBegin()) return (false);
+    bootStage(BOOT_MOUNT);
+    return (true);
+  }
+  if (!sd.fsBegin()) return (false);
+
+  eepromUpdate(LOCATION_SCK_DIVISOR, card->sckDivisor());
+  eepromUpdate(LOCATION_CARD_TYPE, card->type());
+  eepromWriteLong(LOCATION_CARD_SERIAL, cid.psn);
+  for (byte i = 0 ; i < CARD_ID_SIZE ; i++)
+    eepromUpdate(LOCATION_CARD_ID + i, ((byte*)&cid)[i]);
+#else
+  cardReadStatus(card, &cardStatus);
+  if (!sd.fsBegin()) return (false);
+#endif
+  bootStage(BOOT_MOUNT);
+  return (true);
+}
+
+//Log extent: one AU of the card so the log fills whole AUs, the way the card's speed rating is measured.
+//Falls back to LOG_EXTENT_SIZE on cards that don't report an AU or have one outside LOG_EXTENT_SIZE to LOG_EXTENT_MAX.
+uint32_t logExtentSize(void)
+{
+  uint32_t size = cardStatus.auBlocks << 9;
+  if (LOG_EXTENT_SIZE == 0 || size < LOG_EXTENT_SIZE || size > LOG_EXTENT_MAX) return (LOG_EXTENT_SIZE);
+  return (size);
+}
+
+#if ENABLE_SD_LATENCY_STATS
+//How long the RX buffer lasts at the configured baud rate, in ms. Each byte is 10 bits on the wire.
+//The local buffer doesn't count, it holds the data being written while the card is busy.
+unsigned int bufferMsec(void)
+{
+  return (RX_BUFF_SIZE * 10000UL / setting_uart_speed);
+}
+
+
+//Longest the card has held up a write since init or 'cardstats clear', in ms
+uint32_t stallMsec(void)
+{
+  uint32_t stall = sd.card()->latency(SD_LATENCY_BUSY)->max;
+  if (sd.card()->latency(SD_LATENCY_WRITE_DATA)->max > stall) stall = sd.card()->latency(SD_LATENCY_WRITE_DATA)->max;
+  return (stall / 1000);
+}
+#endif
+
+//Bytes logged between syncs while data keeps arriving, 0 to only sync when idle. See SYNC_WRITES.
+uint32_t logSyncSize(void)
+{
+#if ENABLE_SD_LATENCY_STATS
+  if (cardRatedMBps(&cardStatus) == 0 || cardStatus.auBlocks == 0) return (0); //No rating to lean on
+  return (cardStatus.auBlocks << 9);
+#else
+  return (0); //No measured stall to bound the sync with
+#endif
+}
+
+//True if a sync now can't overflow the RX buffer, going by the longest stall measured so far. A sync is only due
+//after an AU of log, so by then the stall covers a good many writes to this card.
+bool syncFits(void)
+{
+#if ENABLE_SD_LATENCY_STATS
+  unsigned int freeBytes = RX_BUFF_SIZE - NewSerial.available();
+  return (stallMsec() * SYNC_WRITES < freeBytes * 10000UL / setting_uart_speed);
+#else
+  return (false);
+#endif
+}
+
+#if PRE_ERASE_SIZE
+//Erases PRE_ERASE_SIZE bytes of the free clusters the log grows into next, one cluster per erase command. The card
+//is busy until an erase is done and nothing moves the RX buffer to the card meanwhile, so erasing stops as soon as a
+//character arrives. Data then waits for at most one cluster's erase. Returns false if stopped before the end.
+bool preEraseLog(SdFile* file)
+{
+  uint32_t clusterSize = 512UL * sd.vol()->blocksPerCluster();
+  for (uint32_t erased = 0 ; erased < PRE_ERASE_SIZE ; erased += clusterSize)
+  {
+    if (NewSerial.available()) return (false);
+    if (!file->preErase(clusterSize, erased)) break; //Not all cards can erase, logging works without it
+  }
+  return (true);
+}
+#endif
+
+//Notes the end of a power up stage. Only the first time counts, later card inits from the shell don't.
+void bootStage(byte stage)
+{
+#if ENABLE_BOOT_TIMING
+  if (bootTime[stage] == 0) bootTime[stage] = millis();
+#endif
+}
+
+//Writes a byte only if it changed, EEPROM cells wear out
+void eepromUpdate(byte location, byte value)
+{
+  if (EEPROM.read(location) != value) EEPROM.write(location, value);
+}
+
+//4 byte values are stored in memory order
+uint32_t eepromReadLong(byte location)
+{
+  uint32_t value;
+  byte* p = (byte*)&value;
+  for (byte i = 0 ; i < 4 ; i++)
+    p[i] = EEPROM.read(location + i);
+  return (value);
+}
+
+void eepromWriteLong(byte location, uint32_t value)
+{
+  byte* p = (byte*)&value;
+  for (byte i = 0 ; i < 4 ; i++)
+    eepromUpdate(location + i, p[i]);
+}
+
+//True if count bytes at location hold the same values as p
+bool eepromMatch(byte location, const byte* p, byte count)
+{
+  for (byte i = 0 ; i < count ; i++)
+    if (EEPROM.read(location + i) != p[i]) return (false);
+  return (true);
+}
+
 //Check to see if we need an emergency UART reset
 //Scan the RX pin for 2 seconds
 //If it's low the entire time, then return 1
@@ -699,7 +1181,7 @@ void checkEmergencyReset(void)
   setDefaultSettings(); //Reset baud, escape characters, escape number, system mode
 
   //Try to setup the SD card so we can record these new settings
-  if (!sd.begin(SD_CHIP_SELECT, SPI_HALF_SPEED)) systemError(ERROR_CARD_INIT);
+  if (!beginCard()) systemError(ERROR_CARD_INIT);
   if (!sd.chdir()) systemError(ERROR_ROOT_INIT); //Change to root directory
 
   recordConfigFile(); //Record new config settings
@@ -1175,6 +1657,11 @@ long readBaud(void)
 void commandShell(void)
 {
   SdFile tempFile;
+#if FILE_HANDLE_COUNT
+  SdFile handles[FILE_HANDLE_COUNT]; //Files left open by the 'open' command
+#else
+  SdFile* handles = 0;
+#endif
   sd.chdir("/", true); //Change to root directory
 
   char commandBuffer[30];
@@ -1202,6 +1689,7 @@ void commandShell(void)
       NewSerial.print(F("!"));
 #endif
     NewSerial.print(F(">"));
+    bootStage(BOOT_READY);
 
     //Read command
     if (readLine(commandBuffer, sizeof(commandBuffer)) < 1)
@@ -1225,7 +1713,8 @@ void commandShell(void)
       if ((feedbackMode & EXTENDED_INFO) > 0)
         NewSerial.println(F("Closing down file system"));
 
-      if (!sd.begin(SD_CHIP_SELECT, SPI_FULL_SPEED)) systemError(ERROR_CARD_INIT);
+      closeHandles(handles); //Handles don't survive the remount
+      if (!beginCard()) systemError(ERROR_CARD_INIT);
       if (!sd.chdir()) systemError(ERROR_ROOT_INIT); //Change to root directory
 
       if ((feedbackMode & EXTENDED_INFO) > 0)
@@ -1279,8 +1768,12 @@ void commandShell(void)
     {
       if ((feedbackMode & EXTENDED_INFO) > 0)
       {
-        NewSerial.print(F("Volume is FAT"));
-        NewSerial.println(sd.vol()->fatType(), DEC);
+        if (sd.vol()->isExFat()) NewSerial.println(F("Volume is exFAT"));
+        else
+        {
+          NewSerial.print(F("Volume is FAT"));
+          NewSerial.println(sd.vol()->fatType(), DEC);
+        }
       }
 
       if (countCmdArgs() == 1)  // has no arguments
@@ -1341,6 +1834,7 @@ void commandShell(void)
       if ((countCmdArgs() == 3) && (strcmp_P(commandArg, PSTR("-rf")) == 0))
       {
         //Remove the subfolder
+        closeHandles(handles); //An open file in the subfolder would be left pointing at freed clusters
         if (tempFile.open(sd.vwd(), getCmdArg(2), O_READ))
         {
           tempVar = tempFile.rmRfStar();
@@ -1358,7 +1852,7 @@ void commandShell(void)
         tempVar = 0;
         if (tempFile.isDir() || tempFile.isSubDir())
           tempVar = tempFile.rmdir();
-        else
+        else if (!isHandleOpen(handles, &tempFile))
         {
           tempFile.close();
           if (tempFile.open(commandArg, O_WRITE))
@@ -1372,42 +1866,23 @@ void commandShell(void)
       }
 
       //Argument 2: File wildcard removal
-      //Fixed by dlkeng - Thank you!
-      uint32_t filesDeleted = 0;
-
-      char fname[13]; //Used to store the file and directory names as we step through this directory
+      //Matching entries are deleted in one pass over the directory, no reopening each file by name
+      uint16_t filesDeleted = 0;
 
       strupr(commandArg);
 
+      closeHandles(handles);
       sd.chdir("/"); //TODO this is required for some reason - putting at top of function doesn't work
-      while (tempFile.openNext(sd.vwd(), O_READ)) //Step through each object in the current directory
-      {
-        if (tempFile.isFile()) // Remove only files
-        {
-          if (tempFile.getSFN(fname)) // Get the filename of the object we're looking at
-          {
-            if (wildcmp(commandArg, fname))  // See if it matches the wildcard
-            {
-              tempFile.close();
-              tempFile.open(fname, O_WRITE);  // Re-open for WRITE to be deleted
-
-              if (tempFile.remove()) // Remove this file
-              {
-                ++filesDeleted;
-              }
-            }
-          }
-        }
-        tempFile.close();
-      }
+      tempVar = sd.vwd()->rmMatching(rmWildcardMatch, commandArg, &filesDeleted);
 
       if ((feedbackMode & EXTENDED_INFO) > 0)
       {
         NewSerial.print(filesDeleted);
         NewSerial.println(F(" file(s) deleted"));
+        if (!tempVar) NewSerial.println(F("Error removing files"));
       }
 #ifdef INCLUDE_SIMPLE_EMBEDDED
-      if (filesDeleted > 0)
+      if (tempVar && filesDeleted > 0)
         commandSucceeded = 1;
 #endif
     }
@@ -1441,8 +1916,9 @@ void commandShell(void)
       if (commandArg == 0)
         continue;
 
-      //search file in current directory and open it
-      if (!tempFile.open(commandArg, O_READ)) {
+      //Use the open handle or search file in current directory and open it
+      SdFile* file = shellFile(handles, commandArg, &tempFile, O_READ);
+      if (file == 0) {
         if ((feedbackMode & EXTENDED_INFO) > 0)
         {
           NewSerial.print(F("Failed to open file "));
@@ -1455,7 +1931,7 @@ void commandShell(void)
       if ((commandArg = getCmdArg(2)) != 0) {
         if ((commandArg = isNumber(commandArg, strlen(commandArg))) != 0) {
           int32_t offset = strToLong(commandArg);
-          if (!tempFile.seekSet(offset)) {
+          if (!file->seekSet(offset)) {
             if ((feedbackMode & EXTENDED_INFO) > 0)
             {
               NewSerial.print(F("Error seeking to "));
@@ -1480,33 +1956,39 @@ void commandShell(void)
           printType = strToLong(commandArg);
 
       //Print file contents from current seek position to the end (readAmount)
-      byte c;
-      int16_t v;
-      uint16_t readSpot = 0;
-      while ((v = tempFile.read()) >= 0) {
-        //file.read() returns a 16 bit character. We want to be able to print extended ASCII
-        //So we need 8 bit unsigned.
-        c = v; //Force the 16bit signed variable into an 8bit unsigned
-
-        if (++readSpot > readAmount) break;
-        if (printType == 1) { //Printing ASCII
-          //Test character to see if it is visible, if not print '.'
-          if (c >= ' ' && c < 127)
-            NewSerial.write(c); //Regular ASCII
-          else if (c == '\n' || c == '\r')
-            NewSerial.write(c); //Go ahead and print the carriage returns and new lines
-          else
-            NewSerial.print(F(".")); //For non visible ASCII characters, print a .
-        }
-        else if (printType == 2) {
-          NewSerial.print(c, HEX); //Print in HEX
-          NewSerial.print(F(" "));
-        }
-        else if (printType == 3) {
-          NewSerial.write(c); //Print raw
+      //The file is read a chunk at a time. A call to read() per byte costs more than the UART
+      //needs to send the byte at high baud rates.
+      //While the file's blocks follow each other the card keeps one multi-block read open
+      byte chunk[32];
+      int16_t n;
+#if ENABLE_SD_READ_STREAM
+      sd.card()->readStreamBegin();
+#endif
+      while (readAmount > 0 && (n = file->read(chunk, readAmount < sizeof(chunk) ? readAmount : sizeof(chunk))) > 0) {
+        readAmount -= n;
+        for (int16_t i = 0 ; i < n ; i++) {
+          byte c = chunk[i];
+          if (printType == 1) { //Printing ASCII
+            //Test character to see if it is visible, if not print '.'
+            if (c >= ' ' && c < 127)
+              NewSerial.write(c); //Regular ASCII
+            else if (c == '\n' || c == '\r')
+              NewSerial.write(c); //Go ahead and print the carriage returns and new lines
+            else
+              NewSerial.print(F(".")); //For non visible ASCII characters, print a .
+          }
+          else if (printType == 2) {
+            NewSerial.print(c, HEX); //Print in HEX
+            NewSerial.print(F(" "));
+          }
+          else if (printType == 3) {
+            NewSerial.write(c); //Print raw
+          }
         }
-
       }
+#if ENABLE_SD_READ_STREAM
+      sd.card()->readStreamEnd();
+#endif
       tempFile.close();
 #ifdef INCLUDE_SIMPLE_EMBEDDED
       commandSucceeded = 1;
@@ -1521,8 +2003,9 @@ void commandShell(void)
       if (commandArg == 0)
         continue;
 
-      //search file in current directory and open it
-      if (!tempFile.open(commandArg, O_WRITE)) {
+      //Use the open handle or search file in current directory and open it
+      SdFile* file = shellFile(handles, commandArg, &tempFile, O_WRITE);
+      if (file == 0) {
         if ((feedbackMode & EXTENDED_INFO) > 0)
         {
           NewSerial.print(F("Failed to open file "));
@@ -1530,12 +2013,17 @@ void commandShell(void)
         }
         continue;
       }
+      //Write an open file through its handle, see isHandleOpen()
+      if (file == &tempFile && isHandleOpen(handles, &tempFile)) {
+        tempFile.close();
+        continue;
+      }
 
       //Argument 3: File seek position
       if ((commandArg = getCmdArg(2)) != 0) {
         if ((commandArg = isNumber(commandArg, strlen(commandArg))) != 0) {
           int32_t offset = strToLong(commandArg);
-          if (!tempFile.seekSet(offset)) {
+          if (!file->seekSet(offset)) {
             if ((feedbackMode & EXTENDED_INFO) > 0)
             {
               NewSerial.print(F("Error seeking to "));
@@ -1576,15 +2064,16 @@ void commandShell(void)
         //}
 
         //write text to file
-        if (tempFile.write((byte*) commandBuffer, dataLen) != dataLen) {
+        if (file->write((byte*) commandBuffer, dataLen) != dataLen) {
           if ((feedbackMode & EXTENDED_INFO) > 0)
             NewSerial.println(F("error writing to file"));
           break;
         }
 
-        if (dataLen < (sizeof(commandBuffer) - 1)) tempFile.write("\n\r", 2); //If we didn't fill up the buffer then user must have sent NL. Append new line and return
+        if (dataLen < (sizeof(commandBuffer) - 1)) file->write("\n\r", 2); //If we didn't fill up the buffer then user must have sent NL. Append new line and return
       }
 
+      file->sync(); //A handle stays open, make sure the text is on the card anyway
       tempFile.close();
     }
     else if (strcmp_P(commandArg, PSTR("size")) == 0)
@@ -1594,9 +2083,10 @@ void commandShell(void)
       if (commandArg == 0)
         continue;
 
-      //search file in current directory and open it
-      if (tempFile.open(commandArg, O_READ)) {
-        NewSerial.print(tempFile.fileSize());
+      //Use the open handle or search file in current directory and open it
+      SdFile* file = shellFile(handles, commandArg, &tempFile, O_READ);
+      if (file != 0) {
+        NewSerial.print(file->fileSize());
         tempFile.close();
 #ifdef INCLUDE_SIMPLE_EMBEDDED
         commandSucceeded = 1;
@@ -1612,6 +2102,94 @@ void commandShell(void)
 #endif
         NewSerial.println();
     }
+#if FILE_HANDLE_COUNT
+    else if (strcmp_P(commandArg, PSTR("open")) == 0)
+    {
+      //Argument 2: File name
+      commandArg = getCmdArg(1);
+      if (commandArg == 0)
+        continue;
+
+      //Find a free handle
+      for (tempVar = 0 ; tempVar < FILE_HANDLE_COUNT ; tempVar++)
+        if (!handles[tempVar].isOpen()) break;
+
+      if (tempVar == FILE_HANDLE_COUNT)
+      {
+        if ((feedbackMode & EXTENDED_INFO) > 0)
+          NewSerial.println(F("No free handle"));
+        continue;
+      }
+
+      //Open for writing if we can, read-only files can still be read
+      if (!handles[tempVar].open(commandArg, O_RDWR) && !handles[tempVar].open(commandArg, O_READ))
+      {
+        if ((feedbackMode & EXTENDED_INFO) > 0)
+        {
+          NewSerial.print(F("Failed to open file "));
+          NewSerial.println(commandArg);
+        }
+        continue;
+      }
+
+      //Directories can't be read or written through a handle
+      if (handles[tempVar].isDir())
+      {
+        handles[tempVar].close();
+        if ((feedbackMode & EXTENDED_INFO) > 0)
+        {
+          NewSerial.print(F("Not a file: "));
+          NewSerial.println(commandArg);
+        }
+        continue;
+      }
+
+      NewSerial.print(F("#"));
+      NewSerial.print(tempVar);
+#ifdef INCLUDE_SIMPLE_EMBEDDED
+      commandSucceeded = 1;
+      if ((feedbackMode & EMBEDDED_END_MARKER) == 0)
+#endif
+        NewSerial.println();
+    }
+    else if (strcmp_P(commandArg, PSTR("seek")) == 0)
+    {
+      //Argument 2: Handle, Argument 3: New position
+      SdFile* file = 0;
+      if ((commandArg = getCmdArg(1)) != 0 && commandArg[0] == '#')
+        file = shellFile(handles, commandArg, &tempFile, O_READ);
+      if (file == 0 || (commandArg = getCmdArg(2)) == 0 || isNumber(commandArg, strlen(commandArg)) == 0)
+        continue;
+
+      if (!file->seekSet(strToLong(commandArg)))
+      {
+        if ((feedbackMode & EXTENDED_INFO) > 0)
+        {
+          NewSerial.print(F("Error seeking to "));
+          NewSerial.println(commandArg);
+        }
+        continue;
+      }
+#ifdef INCLUDE_SIMPLE_EMBEDDED
+      commandSucceeded = 1;
+#endif
+    }
+    else if (strcmp_P(commandArg, PSTR("close")) == 0)
+    {
+      //Argument 2: Handle
+      SdFile* file = 0;
+      if ((commandArg = getCmdArg(1)) != 0 && commandArg[0] == '#')
+        file = shellFile(handles, commandArg, &tempFile, O_READ);
+      if (file == 0)
+        continue;
+
+#ifdef INCLUDE_SIMPLE_EMBEDDED
+      commandSucceeded = file->close();
+#else
+      file->close();
+#endif
+    }
+#endif
     else if (strcmp_P(commandArg, PSTR("disk")) == 0)
     {
       //Print card type
@@ -1672,10 +2250,123 @@ void commandShell(void)
       cardSize *= 0.000512;
       NewSerial.print(cardSize);
       NewSerial.println(F(" MB"));
+
+      //SD Status, read at mount
+      NewSerial.print(F("Speed class: "));
+      NewSerial.println(cardStatus.speedClass);
+      NewSerial.print(F("UHS grade: "));
+      NewSerial.println(cardStatus.uhsGrade);
+      NewSerial.print(F("Video class: "));
+      NewSerial.println(cardStatus.videoClass);
+      NewSerial.print(F("AU size: "));
+      NewSerial.print(cardStatus.auBlocks / 2);
+      NewSerial.println(F(" KB"));
+
+      //What logging derives from it
+      NewSerial.print(F("Log extent: "));
+      NewSerial.print(logExtentSize() / 1024);
+      NewSerial.println(F(" KB"));
+      NewSerial.print(F("Sync: "));
+      uint32_t syncSize = logSyncSize();
+      if (syncSize)
+      {
+        NewSerial.print(F("every "));
+        NewSerial.print(syncSize / 1024);
+        NewSerial.println(F(" KB, when the RX buffer outlasts the longest stall"));
+      }
+      else
+        NewSerial.println(F("when idle"));
+      printCardWarning();
+#if ENABLE_SD_LATENCY_STATS
+      NewSerial.print(F("Longest stall: "));
+      NewSerial.print(stallMsec());
+      NewSerial.println(F("ms"));
+#endif
+#ifdef INCLUDE_SIMPLE_EMBEDDED
+      commandSucceeded = 1;
+#endif
+    }
+#if ENABLE_SD_LATENCY_STATS
+    else if (strcmp_P(commandArg, PSTR("cardstats")) == 0)
+    {
+      //Argument 2: 'clear' starts a new session
+      if ((commandArg = getCmdArg(1)) != 0 && strcmp_P(commandArg, PSTR("clear")) == 0)
+      {
+        sd.card()->latencyClear();
+      }
+      else
+      {
+        NewSerial.println(F("Card latency in micros since init or clear"));
+        printLatency(F("busy"), sd.card()->latency(SD_LATENCY_BUSY));
+        printLatency(F("writeData"), sd.card()->latency(SD_LATENCY_WRITE_DATA));
+#if ENABLE_SD_LATENCY_STATS > 1
+        printLatency(F("command"), sd.card()->latency(SD_LATENCY_COMMAND));
+        printLatency(F("readBlock"), sd.card()->latency(SD_LATENCY_READ_BLOCK));
+        printLatency(F("writeBlock"), sd.card()->latency(SD_LATENCY_WRITE_BLOCK));
+#endif
+      }
 #ifdef INCLUDE_SIMPLE_EMBEDDED
       commandSucceeded = 1;
 #endif
     }
+#endif
+#if ENABLE_FORMAT_COMMAND
+    else if (strcmp_P(commandArg, PSTR("format")) == 0)
+    {
+      //Everything on the card is lost, so ask first
+      NewSerial.print(F("Erase and format card? Type Y: "));
+      readLine(commandBuffer, sizeof(commandBuffer));
+      commandArg = getCmdArg(0);
+      if (commandArg == 0 || strcmp_P(commandArg, PSTR("Y")) != 0)
+        continue;
+
+      NewSerial.print(F("AU size (KB): "));
+      NewSerial.println(cardStatus.auBlocks / 2);
+
+      closeHandles(handles);
+
+      //The volume cache is free to use as a scratch block once it has been flushed
+      cache_t* cache = sd.vol()->cacheClear();
+      if (cache == 0 || !cardFormat(sd.card(), cache, &NewSerial))
+      {
+        NewSerial.println(F("Format failed"));
+        continue;
+      }
+
+      //Mount the new volume
+      if (!beginCard()) systemError(ERROR_CARD_INIT);
+      if (!sd.chdir()) systemError(ERROR_ROOT_INIT);
+      NewSerial.println(F("\nFormat done"));
+#ifdef INCLUDE_SIMPLE_EMBEDDED
+      commandSucceeded = 1;
+#endif
+    }
+#endif
+#if ENABLE_BOOT_CAPTURE || ENABLE_BOOT_TIMING
+    else if (strcmp_P(commandArg, PSTR("boot")) == 0)
+    {
+#if ENABLE_BOOT_CAPTURE
+      //Show how well power up kept up with the incoming serial data
+      NewSerial.print(F("Bytes captured before ready: "));
+      NewSerial.println(bootBytesCaptured);
+      NewSerial.print(F("Bytes lost during boot: "));
+      NewSerial.println(bootBytesLost);
+#endif
+#if ENABLE_BOOT_TIMING
+      //Milliseconds from reset to the end of each stage
+      printBootStage(F("Card init"), BOOT_CARD);
+      printBootStage(F("Mount"), BOOT_MOUNT);
+      printBootStage(F("Config"), BOOT_CONFIG);
+      printBootStage(F("Log open"), BOOT_LOG);
+      printBootStage(F("Ready"), BOOT_READY);
+      NewSerial.print(F("Known card: "));
+      NewSerial.println(cardKnown);
+#endif
+#ifdef INCLUDE_SIMPLE_EMBEDDED
+      commandSucceeded = 1;
+#endif
+    }
+#endif
     else if (strcmp_P(commandArg, PSTR("sync")) == 0)
     {
       //This feature has been removed in version 4
@@ -1724,6 +2415,14 @@ void commandShell(void)
       commandArg = getCmdArg(1);
       if (commandArg == 0)
         continue;
+      //Don't append to a file open through a handle, see isHandleOpen(). A missing file isn't open.
+      if (tempFile.open(commandArg, O_READ))
+      {
+        tempVar = isHandleOpen(handles, &tempFile);
+        tempFile.close();
+        if (tempVar)
+          continue;
+      }
       //appendFile: Uses circular buffer to capture full stream of text and append to file
 #ifdef INCLUDE_SIMPLE_EMBEDDED
       // If appendFile() returns, then the write to the file is complete
@@ -1832,6 +2531,9 @@ byte readLine(char* readBuffer, byte bufferLength)
   while (readLength < bufferLength - 1) {
     while (!NewSerial.available());
     byte c = NewSerial.read();
+#if ENABLE_TWI_INGEST
+    twiIngestPoll(); //Shell input may also arrive over I2C
+#endif
 
     toggleLED(stat1);
 
@@ -1919,7 +2621,21 @@ void printMenu(void)
   NewSerial.println(F("ls\t\t\t: Shows the content of the current directory.."));
   NewSerial.println(F("read <file> <start> <length> <type>: Outputs <length> bytes of <file> to the terminal starting at <start>. Omit <start> and <length> to read whole file. <type> 1 prints in ASCII, 2 in HEX."));
   NewSerial.println(F("size <file>\t\t: Write size of <file> to terminal"));
+#if FILE_HANDLE_COUNT
+  NewSerial.println(F("open <file>\t\t: Opens <file> and prints a handle (#0) to use as <file> in read, write and size"));
+  NewSerial.println(F("seek <#> <pos>\t\t: Moves handle <#> to <pos>"));
+  NewSerial.println(F("close <#>\t\t: Closes handle <#>"));
+#endif
   NewSerial.println(F("disk\t\t\t: Shows card information"));
+#if ENABLE_SD_LATENCY_STATS
+  NewSerial.println(F("cardstats <clear>\t: Shows card latency histograms. 'clear' starts over"));
+#endif
+#if ENABLE_FORMAT_COMMAND
+  NewSerial.println(F("format\t\t\t: Erases and formats the card aligned to its erase blocks"));
+#endif
+#if ENABLE_BOOT_CAPTURE || ENABLE_BOOT_TIMING
+  NewSerial.println(F("boot\t\t\t: Shows bytes captured and lost during power up and when each boot stage ended"));
+#endif
 
   //NewSerial.println(F("init\t\t\t: Reinitializes and reopens the memory card"));
   //NewSerial.println(F("sync\t\t\t: Ensures all buffered data is written to the card"));
@@ -2197,6 +2913,156 @@ byte countCmdArgs(void)
   return count;
 }
 
+//Warns if the card may not keep up with the configured baud rate
+void printCardWarning(void)
+{
+  if (cardRatedMBps(&cardStatus) == 0)
+  {
+    NewSerial.print(F("Warning: card has no speed class, it may not keep up at "));
+    NewSerial.print(setting_uart_speed);
+    NewSerial.println(F("bps"));
+  }
+
+#if ENABLE_SD_LATENCY_STATS
+  //The longest the card has held up a write since init or 'cardstats clear'. Longer than the serial
+  //buffers last and incoming data was dropped.
+  uint32_t stall = stallMsec();
+  if (stall >= bufferMsec())
+  {
+    NewSerial.print(F("Warning: card stalled "));
+    NewSerial.print(stall);
+    NewSerial.print(F("ms, buffers last "));
+    NewSerial.print(bufferMsec());
+    NewSerial.print(F("ms at "));
+    NewSerial.print(setting_uart_speed);
+    NewSerial.println(F("bps"));
+  }
+#endif
+}
+
+#if ENABLE_BOOT_TIMING
+void printBootStage(const __FlashStringHelper* name, byte stage)
+{
+  NewSerial.print(name);
+  NewSerial.print(F(": "));
+  NewSerial.print(bootTime[stage]);
+  NewSerial.println(F("ms"));
+}
+#endif
+
+#if ENABLE_SD_LATENCY_STATS
+//Prints one line per card operation: count, failures, longest time, percentiles and the histogram buckets that
+//aren't empty. A percentile is the upper edge of the bucket it falls in, or the longest time if that is smaller.
+//Timeouts land in the last bucket. Counts stop at 255 on small builds, so percentiles drift after that many.
+static const uint16_t latencyPerMille[] PROGMEM = {500, 900, 990, 999};
+
+void printLatency(const __FlashStringHelper* name, const SdLatency* latency)
+{
+  uint32_t total = 0;
+  for (byte b = 0 ; b < SD_LATENCY_BUCKETS ; b++)
+    total += latency->count[b];
+
+  NewSerial.print(name);
+  NewSerial.print(F(": n="));
+  NewSerial.print(total);
+  if (latency->fail > 0)
+  {
+    NewSerial.print(F(" fail="));
+    NewSerial.print(latency->fail);
+  }
+  NewSerial.print(F(" max="));
+  NewSerial.print(latency->max);
+
+  for (byte i = 0 ; total > 0 && i < sizeof(latencyPerMille) / sizeof(latencyPerMille[0]) ; i++)
+  {
+    uint16_t perMille = pgm_read_word(&latencyPerMille[i]);
+    uint32_t need = (total * perMille + 999) / 1000;
+    uint32_t seen = latency->count[0];
+    byte b = 0;
+    while (seen < need && b < SD_LATENCY_BUCKETS - 1)
+      seen += latency->count[++b];
+
+    uint32_t edge = 64UL << b;
+    if (b == SD_LATENCY_BUCKETS - 1 || edge > latency->max) edge = latency->max;
+
+    NewSerial.print(F(" p"));
+    NewSerial.print(perMille / 10);
+    if (perMille % 10)
+    {
+      NewSerial.print(F("."));
+      NewSerial.print(perMille % 10);
+    }
+    NewSerial.print(F("<="));
+    NewSerial.print(edge);
+  }
+  NewSerial.println();
+
+  //Buckets double in width, bucket 0 is under 64us
+  for (byte b = 0 ; b < SD_LATENCY_BUCKETS ; b++)
+  {
+    if (latency->count[b] == 0) continue;
+    if (b == SD_LATENCY_BUCKETS - 1)
+    {
+      NewSerial.print(F(" >="));
+      NewSerial.print(32UL << b);
+    }
+    else
+    {
+      NewSerial.print(F(" <"));
+      NewSerial.print(64UL << b);
+    }
+    NewSerial.print(F(":"));
+    NewSerial.print(latency->count[b]);
+  }
+  NewSerial.println();
+}
+#endif
+
+//Returns the file a shell command acts on. arg is either a handle from the 'open' command (#0, #1, ..)
+//or a file name in the current directory, which is opened into tempFile. Returns 0 if neither works.
+SdFile* shellFile(SdFile* handles, const char* arg, SdFile* tempFile, byte oflag)
+{
+#if FILE_HANDLE_COUNT
+  if (arg[0] == '#')
+  {
+    byte h = arg[1] - '0';
+    if (arg[2] != 0 || h >= FILE_HANDLE_COUNT || !handles[h].isOpen()) return (0);
+    return (&handles[h]);
+  }
+#endif
+  if (!tempFile->open(arg, oflag)) return (0);
+  return (tempFile);
+}
+
+//Closes the files left open by the 'open' command. Called before commands that delete files or remount the card,
+//which would leave a handle pointing at a freed directory entry or clusters.
+void closeHandles(SdFile* handles)
+{
+#if FILE_HANDLE_COUNT
+  for (byte h = 0 ; h < FILE_HANDLE_COUNT ; h++)
+    handles[h].close();
+#endif
+}
+
+//Returns true if file is also open through a handle, and tells the user to close it first. Two open files are the
+//same file when their directory entries are at the same index and they start at the same cluster. Empty files have
+//no cluster, so an empty file can match another empty file in a different directory. rm, write and append then
+//refuse until the handle is closed. The handle would otherwise write back its old size and clusters when closed.
+bool isHandleOpen(SdFile* handles, SdFile* file)
+{
+#if FILE_HANDLE_COUNT
+  for (byte h = 0 ; h < FILE_HANDLE_COUNT ; h++)
+    if (handles[h].isOpen() && handles[h].dirIndex() == file->dirIndex()
+        && handles[h].firstCluster() == file->firstCluster())
+    {
+      if ((feedbackMode & EXTENDED_INFO) > 0)
+        NewSerial.println(F("File is open, close it first"));
+      return (true);
+    }
+#endif
+  return (false);
+}
+
 //Safe index handling of command line arguments
 char general_buffer[30]; //Needed for command shell
 #define MIN(a,b) ((a)<(b))?(a):(b)
@@ -2321,6 +3187,12 @@ byte wildcmp(const char* wild, const char* string)
   return !(*wild);
 }
 
+//rmMatching() callback for the wildcard rm command
+bool rmWildcardMatch(const char* fileName, const void* wild)
+{
+  return (wildcmp((const char*)wild, fileName));
+}
+
 //End wildcard functions
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 
@@ -0,0 +1,168 @@
+/*
+  OpenLog I2C (TWI) slave ingest - see TwiIngest.h for the protocol
+*/
+
+#include "TwiIngest.h"
+
+//Frame parser states
+#define STATE_IDLE     0 //Not addressed
+#define STATE_COMMAND  1 //Addressed for write, waiting for the command byte
+#define STATE_LOG      2 //Payload bytes go to the sink
+#define STATE_DISCARD  3 //Payload bytes are ignored
+
+void TwiIngest::begin(sink_t sink)
+{
+  this->sink = sink;
+  state = STATE_IDLE;
+  status = 0;
+  stall = false;
+}
+
+//Our address was matched. A write starts a new frame.
+void TwiIngest::addressed(bool read)
+{
+  state = read ? STATE_IDLE : STATE_COMMAND;
+}
+
+//A data byte was received and already ACK'd by the hardware
+//The return value decides what happens to the next byte
+uint8_t TwiIngest::received(uint8_t b)
+{
+  switch (state)
+  {
+    case STATE_COMMAND:
+      if (b == TWI_CMD_LOG)
+      {
+        state = STATE_LOG;
+        return (TWI_ACK);
+      }
+      state = STATE_DISCARD;
+      if (b == TWI_CMD_STATUS) return (TWI_ACK);
+      status |= TWI_STATUS_BAD_COMMAND;
+      return (TWI_NACK);
+
+    case STATE_LOG:
+      if (sink(b)) return (TWI_ACK);
+      //No room. Hold on to the byte and keep the master waiting.
+      pending = b;
+      stall = true;
+      status |= TWI_STATUS_STALLED;
+      return (TWI_STALL);
+  }
+  return (TWI_ACK);
+}
+
+//Master is reading from us
+uint8_t TwiIngest::transmit()
+{
+  uint8_t s = status;
+  if (stall) s |= TWI_STATUS_STALLED;
+  status = 0; //Reading clears the sticky bits
+  return (s);
+}
+
+//Stop or repeated start, the frame is complete
+void TwiIngest::stopped()
+{
+  state = STATE_IDLE;
+}
+
+bool TwiIngest::resume()
+{
+  if (!stall) return (true);
+  if (!sink(pending)) return (false);
+  stall = false;
+  return (true);
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//AVR TWI hardware glue
+
+#if ENABLE_TWI_INGEST && defined(__AVR__)
+
+#include <avr/interrupt.h>
+#include <avr/power.h>
+#include <util/twi.h>
+
+TwiIngest twiIngest;
+
+//Release the clock. ack selects whether the next byte is ACK'd.
+static inline void twiReply(bool ack)
+{
+  TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | (ack ? _BV(TWEA) : 0);
+}
+
+void twiIngestBegin(uint8_t address, TwiIngest::sink_t sink)
+{
+  twiIngest.begin(sink);
+  power_twi_enable();
+  TWAR = address << 1; //No general call
+  twiReply(true);
+}
+
+//Called from the main loop once the RX buffer has been drained
+//If a byte was held, store it and let the master continue
+void twiIngestPoll(void)
+{
+  if (!twiIngest.stalled()) return;
+
+  uint8_t sreg = SREG;
+  cli(); //The UART interrupt also writes to the ring buffer
+  if (twiIngest.resume()) twiReply(true);
+  SREG = sreg;
+}
+
+ISR(TWI_vect)
+{
+  switch (TW_STATUS)
+  {
+    //Slave receiver
+    case TW_SR_SLA_ACK:
+    case TW_SR_ARB_LOST_SLA_ACK:
+      twiIngest.addressed(false);
+      twiReply(true);
+      break;
+
+    case TW_SR_DATA_ACK:
+      {
+        uint8_t action = twiIngest.received(TWDR);
+        if (action == TWI_STALL)
+        {
+          //Disable the interrupt but leave TWINT set. The hardware holds SCL low until
+          //twiIngestPoll() finds room for the byte.
+          TWCR = _BV(TWEN);
+          return;
+        }
+        twiReply(action == TWI_ACK);
+      }
+      break;
+
+    case TW_SR_DATA_NACK:
+    case TW_SR_STOP:
+      twiIngest.stopped();
+      twiReply(true);
+      break;
+
+    //Slave transmitter
+    case TW_ST_SLA_ACK:
+    case TW_ST_ARB_LOST_SLA_ACK:
+      twiIngest.addressed(true);
+    //Fall through
+    case TW_ST_DATA_ACK:
+      TWDR = twiIngest.transmit();
+      twiReply(true);
+      break;
+
+    case TW_BUS_ERROR:
+      //Release the bus and go back to listening
+      twiIngest.stopped();
+      TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWEA) | _BV(TWSTO);
+      break;
+
+    default: //TW_ST_DATA_NACK, TW_ST_LAST_DATA
+      twiReply(true);
+      break;
+  }
+}
+
+#endif
@@ -0,0 +1,86 @@
+/*
+  OpenLog I2C (TWI) slave ingest
+
+  Lets a host that has no spare UART feed OpenLog over I2C. Bytes received this way are pushed into
+  the same RX ring buffer the UART interrupt fills, so appendFile() and the command shell see them
+  exactly like serial characters.
+
+  Protocol - every I2C write transaction is one frame:
+
+    [S] [addr+W] [command] [payload ...] [P]
+
+    TWI_CMD_LOG (0x00)    - Every payload byte is appended to the log, in order.
+    TWI_CMD_STATUS (0x01) - No payload. Following reads return the status byte.
+    Anything else         - Rest of the frame is NACK'd and TWI_STATUS_BAD_COMMAND is set.
+
+  A read transaction ([S] [addr+R] [status] [P]) returns the status byte and clears its sticky bits.
+
+  No byte that has been ACK'd is ever dropped. If the ring buffer is full, OpenLog holds SCL low
+  (clock stretching) until appendFile() has drained the ring and twiIngestPoll() pushes the held byte.
+  Hosts must therefore support clock stretching.
+
+  The TwiIngest class has no hardware dependencies. The AVR interrupt translates TWSR status codes into
+  calls to addressed()/received()/transmit()/stopped(). A simulated bus on a PC can make the same calls
+  to exercise the protocol.
+*/
+
+#ifndef TwiIngest_h
+#define TwiIngest_h
+
+#include <stdint.h>
+
+//Set to 1 to enable the I2C slave ingest channel. Costs roughly 600 bytes of flash.
+//When 0 the TWI peripheral stays powered down, as before.
+#define ENABLE_TWI_INGEST 0
+
+//7-bit slave address OpenLog answers to
+#define TWI_INGEST_ADDRESS 0x2A
+
+//Frame commands, the first byte of every write transaction
+#define TWI_CMD_LOG     0x00
+#define TWI_CMD_STATUS  0x01
+
+//Status byte bits
+#define TWI_STATUS_STALLED      0x01 //The bus has been stretched because the RX buffer was full (sticky)
+#define TWI_STATUS_BAD_COMMAND  0x02 //A frame started with an unknown command (sticky)
+
+//What the bus should do after a received byte
+#define TWI_ACK    0 //Keep accepting bytes
+#define TWI_NACK   1 //Refuse the rest of this frame
+#define TWI_STALL  2 //Byte is held, stretch the clock until resume() succeeds
+
+class TwiIngest {
+  public:
+    //Called with each payload byte. Must return false if there is no room for the byte.
+    typedef bool (*sink_t)(uint8_t b);
+
+    void begin(sink_t sink);
+
+    //Bus events
+    void addressed(bool read);
+    uint8_t received(uint8_t b);
+    uint8_t transmit();
+    void stopped();
+
+    //Retries the held byte. Returns true if the clock can be released.
+    bool resume();
+    bool stalled() {
+      return stall;
+    }
+
+  private:
+    sink_t sink;
+    uint8_t state;
+    uint8_t status;
+    uint8_t pending;
+    volatile bool stall;
+};
+
+#if ENABLE_TWI_INGEST
+extern TwiIngest twiIngest;
+
+void twiIngestBegin(uint8_t address, TwiIngest::sink_t sink);
+void twiIngestPoll(void);
+#endif
+
+#endif
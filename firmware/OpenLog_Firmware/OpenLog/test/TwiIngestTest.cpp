@@ -0,0 +1,147 @@
+/*
+  Host test for the TwiIngest frame parser
+
+  Drives TwiIngest through the same calls the AVR TWI interrupt makes, with a small ring as the sink,
+  and checks what ends up in the ring and what the bus is told to do. No hardware needed:
+
+    g++ -I.. -o TwiIngestTest TwiIngestTest.cpp ../TwiIngest.cpp && ./TwiIngestTest
+
+  The Arduino IDE doesn't compile sketch subfolders, so this file isn't part of the firmware.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "TwiIngest.h"
+
+//Stands in for the serial RX ring buffer
+#define RING_SIZE 8
+static uint8_t ring[RING_SIZE];
+static uint8_t ringCount;
+
+static bool ringPut(uint8_t b)
+{
+  if (ringCount == RING_SIZE) return (false);
+  ring[ringCount++] = b;
+  return (true);
+}
+
+//Empties the ring the way appendFile() does, returns the bytes removed
+static uint8_t ringDrain(uint8_t* dst)
+{
+  uint8_t n = ringCount;
+  memcpy(dst, ring, n);
+  ringCount = 0;
+  return (n);
+}
+
+static int failures;
+
+#define CHECK(cond) check(cond, #cond, __LINE__)
+static void check(bool cond, const char* text, int line)
+{
+  if (cond) return;
+  printf("FAIL line %d: %s\n", line, text);
+  failures++;
+}
+
+//One write transaction: [S] [addr+W] [command] [payload ...] [P]
+//Returns the action for the last byte the bus saw, stops early on NACK or stall
+static uint8_t writeFrame(TwiIngest* twi, uint8_t command, const uint8_t* payload, uint8_t n, uint8_t* sent)
+{
+  twi->addressed(false);
+  uint8_t action = twi->received(command);
+  *sent = 0;
+  while (action == TWI_ACK && *sent < n)
+    action = twi->received(payload[(*sent)++]);
+  if (action != TWI_STALL) twi->stopped();
+  return (action);
+}
+
+//One read transaction: [S] [addr+R] [status] [P]
+static uint8_t readStatus(TwiIngest* twi)
+{
+  twi->addressed(true);
+  uint8_t s = twi->transmit();
+  twi->stopped();
+  return (s);
+}
+
+static void testLog(void)
+{
+  TwiIngest twi;
+  uint8_t sent;
+  uint8_t out[RING_SIZE];
+  const uint8_t text[] = {'a', 'b', 'c'};
+
+  ringCount = 0;
+  twi.begin(ringPut);
+  CHECK(writeFrame(&twi, TWI_CMD_LOG, text, sizeof(text), &sent) == TWI_ACK);
+  CHECK(sent == sizeof(text));
+  CHECK(ringDrain(out) == sizeof(text));
+  CHECK(memcmp(out, text, sizeof(text)) == 0);
+  CHECK(readStatus(&twi) == 0);
+}
+
+static void testBadCommand(void)
+{
+  TwiIngest twi;
+  uint8_t sent;
+  const uint8_t text[] = {'x'};
+
+  ringCount = 0;
+  twi.begin(ringPut);
+  CHECK(writeFrame(&twi, 0x7F, text, sizeof(text), &sent) == TWI_NACK);
+  CHECK(sent == 0);
+  CHECK(ringCount == 0);
+  CHECK(readStatus(&twi) == TWI_STATUS_BAD_COMMAND);
+  CHECK(readStatus(&twi) == 0); //Sticky bits clear on read
+
+  //A status frame has no payload, anything after the command is dropped
+  CHECK(writeFrame(&twi, TWI_CMD_STATUS, text, sizeof(text), &sent) == TWI_ACK);
+  CHECK(ringCount == 0);
+}
+
+//A full ring stalls the bus on the byte that didn't fit. Nothing ACK'd is lost.
+static void testStall(void)
+{
+  TwiIngest twi;
+  uint8_t sent;
+  uint8_t out[RING_SIZE];
+  uint8_t payload[RING_SIZE + 3];
+
+  for (uint8_t i = 0 ; i < sizeof(payload) ; i++)
+    payload[i] = i;
+
+  ringCount = 0;
+  twi.begin(ringPut);
+  CHECK(writeFrame(&twi, TWI_CMD_LOG, payload, sizeof(payload), &sent) == TWI_STALL);
+  CHECK(sent == RING_SIZE + 1); //The byte after the ring filled is held
+  CHECK(twi.stalled());
+  CHECK(!twi.resume()); //Still no room
+
+  //appendFile() drains the ring, twiIngestPoll() retries the held byte
+  CHECK(ringDrain(out) == RING_SIZE);
+  CHECK(memcmp(out, payload, RING_SIZE) == 0);
+  CHECK(twi.resume());
+  CHECK(!twi.stalled());
+  CHECK(ringCount == 1 && ring[0] == payload[RING_SIZE]);
+
+  //The clock is released and the master sends the rest of the frame
+  for (; sent < sizeof(payload) ; sent++)
+    CHECK(twi.received(payload[sent]) == TWI_ACK);
+  twi.stopped();
+  CHECK(ringDrain(out) == 3);
+  CHECK(memcmp(out, payload + RING_SIZE, 3) == 0);
+
+  CHECK(readStatus(&twi) == TWI_STATUS_STALLED);
+  CHECK(readStatus(&twi) == 0);
+}
+
+int main(void)
+{
+  testLog();
+  testBadCommand();
+  testStall();
+  printf(failures ? "%d failed\n" : "OK\n", failures);
+  return (failures ? 1 : 0);
+}